@@ -12,6 +12,7 @@
 //km
 #include <KMlocal.h>
 #include <gdalutilities.h>
+#include <tiles.h>
 
 namespace ClasterUtils
 {
@@ -339,4 +340,38 @@ ClasterUtils::ClasterizeByCentroids(OGRGeometryCollection * polygons, int nclast
 	//сортируем геометрию по кластерам
 	res = SortGeometry(cdata);
 	return res;
-}
\ No newline at end of file
+}
+
+std::vector<int> *
+ClasterUtils::ClasterizeTiles(Tiles::TileCollection *tiles, int nclasters)
+{
+    assert(tiles != nullptr);
+
+    int ntiles = tiles->size();
+    //нечего кластеризовать
+    if (ntiles == 0)
+        return nullptr;
+    //кластеров не больше, чем тайлов
+    if (ntiles < nclasters)
+        nclasters = ntiles;
+
+    ClasterData cdata;
+    InitClasterData(cdata, nclasters);
+    //данные кластеризации - опорные точки тайлов
+    cdata.dataPoints = new KMdata(2, ntiles);
+    for (int i = 0;i < ntiles;i++)
+    {
+        KMpoint &p = (*cdata.dataPoints)[i];
+        const OGRRawPoint &c = tiles->metrics(i).center;
+        p[0] = c.x;
+        p[1] = c.y;
+    }
+    cdata.dataPoints->setNPts(ntiles);
+
+    //запускаем алгоритм кластеризации
+    ClasterCore(cdata);
+
+    auto res = new std::vector<int>(cdata.closeCtr, cdata.closeCtr + ntiles);
+    DestroyClasterData(cdata);
+    return res;
+}
@@ -19,6 +19,10 @@ class KMdata;
 class KMfilterCenters;
 class OGRGeometryCollection;
 class OGRMultiPolygon;
+namespace Tiles
+{
+    class TileCollection;
+}
 
 /*!
 \brief Различные утилиты кластеризации
@@ -80,6 +84,20 @@ namespace ClasterUtils
     */
 	GeometryClasters *ClasterizeByCentroids(OGRGeometryCollection* polygons,
 		int nclasters = 10);
+
+    /*!
+    \brief Кластеризация тайлов по опорным точкам
+    \details Тайлы кластеризуются методом k-means по опорным
+    точкам из таблицы характеристик коллекции, поэтому центроиды
+    заново не считаются, а геометрия не копируется.
+    \param tiles Коллекция тайлов. Не может быть nullptr
+    \param nclasters Число кластеров. Если тайлов меньше, то
+    число кластеров равно числу тайлов
+    \return Новый массив номеров кластеров для каждого индекса тайла,
+    nullptr если коллекция пустая
+    */
+    std::vector<int> *ClasterizeTiles(Tiles::TileCollection *tiles,
+        int nclasters = 10);
 }
 
 #endif
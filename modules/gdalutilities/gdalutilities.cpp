@@ -1,7 +1,10 @@
 #include "gdalutilities.h"
 //std
 #include <assert.h>
+#include <cmath>
+#include <limits>
 #include <memory>
+#include <queue>
 #include <algorithm>
 #include <iostream>
 
@@ -9,6 +12,10 @@
 #include <Windows.h>
 #endif
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 namespace GDALUtilities
 {
 
@@ -201,32 +208,27 @@ OGRPoint * FailsafeCentroid(OGRGeometry * p)
         auto gtype = p->getGeometryType();
         if (gtype == wkbPolygon)
         {
-            auto geom = dynamic_cast<OGRPolygon*>(p);
-            MakeSmartPtr(pts,MultiPoint,FetchPointsFromPolygon(geom));
-            if (!pts.get())
+            auto geom = static_cast<OGRPolygon*>(p);
+            OGRLinearRing *ext = geom->getExteriorRing();
+            if (!ext)
             {
-                //не смогли получить точки полигона
+                //нет внешнего контура
                 //ошибка
                 return centroid;
             }
 
-            //считаем расстояния между точкой и точками полигона
-            //в памяти хранятся пары расстояние-указатель на точку
-            vector<pair<double, OGRGeometry*>> distances;
-            for (int i = 0;i < pts->getNumGeometries();i++)
-            {
-                //считаем расстояние
-                double dst = centroid->Distance(pts->getGeometryRef(i));
-                distances.push_back(pair<double, OGRGeometry*>(dst, pts->getGeometryRef(i)));
-            }
-            //ищем минимальное расстояние от старого центроида до точек полигона
-            //через итератор imin
-            auto imin = min_element(distances.begin(), distances.end());
-            //разыменовываем итератор и приводим тип к OGRPoint
-            auto n_centroid = dynamic_cast<OGRPoint*>((*imin).second->clone());
-            //в n_centroid ближайшая точка
-            assert(n_centroid);
-            return n_centroid;
+            //ищем ближайшую к старому центроиду вершину контура
+            auto nearest = NearestVertex(ext,
+                centroid->getX(), centroid->getY());
+            int imin = std::get<0>(nearest);
+            if (imin < 0)
+                //нет точек, ошибка
+                return centroid;
+
+            //в centroid записываем ближайшую точку
+            centroid->setX(ext->getX(imin));
+            centroid->setY(ext->getY(imin));
+            return centroid;
         }
         else
             return centroid;
@@ -354,31 +356,241 @@ OGRMultiPoint * FetchPointsFromPolygon(OGRPolygon * p)
 double InscribedCircleRadius(OGRPolygon * p)
 {
     assert(p);
-    //не принимаем nullptr
-    MakeSmartPtr(pts, MultiPoint, FetchPointsFromPolygon(p));
-    if (!pts.get())
+
+    //находим центроид полигона
+    MakeSmartPtr(centroid, Point, FailsafeCentroid(p));
+
+    return InscribedCircleRadius(p, centroid.get());
+}
+
+std::tuple<int, double> NearestVertex(OGRSimpleCurve *line, double x, double y)
+{
+    assert(line);
+
+    int n = line->getNumPoints();
+    if (n == 0)
+        return std::make_tuple(-1, -1.0);
+
+    //координаты вершин одним массивом
+    std::vector<OGRRawPoint> pts(n);
+    line->getPoints(pts.data());
+    const OGRRawPoint *raw = pts.data();
+
+    //минимум квадрата расстояния
+    double dmin = std::numeric_limits<double>::max();
+#if defined(_OPENMP) && _OPENMP >= 201307
+#pragma omp simd reduction(min:dmin)
+#endif
+    for (int i = 0;i < n;i++)
     {
-        //не смогли получить точки полигона
-        //ошибка
-        return -1;
+        double dx = raw[i].x - x;
+        double dy = raw[i].y - y;
+        double d = dx*dx + dy*dy;
+        dmin = (d < dmin) ? d : dmin;
     }
-    if (pts->getNumGeometries() == 0)
-        //нет точек, ошибка
-        return -1;
 
-    //находим центроид полигона
-    OGRPoint* centroid = FailsafeCentroid(p);
+    //номер вершины с найденным расстоянием
+    int imin = 0;
+    for (int i = 0;i < n;i++)
+    {
+        double dx = raw[i].x - x;
+        double dy = raw[i].y - y;
+        if (dx*dx + dy*dy == dmin)
+        {
+            imin = i;
+            break;
+        }
+    }
+
+    return std::make_tuple(imin, dmin);
+}
+
+//контуры полигона в виде массивов координат
+typedef std::vector< std::vector<OGRRawPoint> > RawRings;
+
+//ячейка для поиска полюса недоступности
+struct PoleCell
+{
+    //центр ячейки
+    double x, y;
+    //половина стороны
+    double h;
+    //расстояние от центра до границы, со знаком
+    double d;
+    //максимально возможное расстояние внутри ячейки
+    double max;
+
+    PoleCell(double _x, double _y, double _h, const RawRings &rings);
+
+    bool operator<(const PoleCell &c) const { return max < c.max; }
+};
+
+//квадрат расстояния от точки до отрезка ab
+static double SegmentDistance2(double x, double y,
+    const OGRRawPoint &a, const OGRRawPoint &b)
+{
+    double px = a.x, py = a.y;
+    double dx = b.x - px, dy = b.y - py;
+
+    if (dx != 0 || dy != 0)
+    {
+        double t = ((x - px)*dx + (y - py)*dy) / (dx*dx + dy*dy);
+        if (t > 1)
+        {
+            px = b.x;
+            py = b.y;
+        }
+        else if (t > 0)
+        {
+            px += dx*t;
+            py += dy*t;
+        }
+    }
+
+    dx = x - px;
+    dy = y - py;
+    return dx*dx + dy*dy;
+}
+
+//расстояние от точки до границы полигона, положительное
+//внутри полигона и отрицательное снаружи
+static double SignedDistance(double x, double y, const RawRings &rings)
+{
+    bool inside = false;
+    double dmin = std::numeric_limits<double>::max();
+
+    for (auto r = rings.begin();r != rings.end();r++)
+    {
+        const std::vector<OGRRawPoint> &ring = (*r);
+        size_t n = ring.size();
+        for (size_t i = 0, j = n - 1;i < n;j = i++)
+        {
+            const OGRRawPoint &a = ring[i];
+            const OGRRawPoint &b = ring[j];
+            //луч вправо от точки пересекает ребро
+            if ((a.y > y) != (b.y > y) &&
+                (x < (b.x - a.x)*(y - a.y) / (b.y - a.y) + a.x))
+                inside = !inside;
+            dmin = std::min(dmin, SegmentDistance2(x, y, a, b));
+        }
+    }
+
+    return (inside ? 1 : -1)*sqrt(dmin);
+}
+
+PoleCell::PoleCell(double _x, double _y, double _h, const RawRings &rings)
+    : x(_x), y(_y), h(_h)
+{
+    d = SignedDistance(x, y, rings);
+    max = d + h*sqrt(2.0);
+}
+
+std::tuple<OGRRawPoint, double> PoleOfInaccessibility(OGRPolygon *p,
+    double precision)
+{
+    assert(p);
+
+    OGREnvelope env;
+    p->getEnvelope(&env);
+    OGRRawPoint center((env.MinX + env.MaxX) / 2, (env.MinY + env.MaxY) / 2);
+
+    OGRLinearRing *ext = p->getExteriorRing();
+    if (!ext || ext->getNumPoints() < 4)
+        //пустой полигон
+        return std::make_tuple(center, -1.0);
+
+    //копируем координаты контуров один раз
+    RawRings rings(1 + p->getNumInteriorRings());
+    for (size_t i = 0;i < rings.size();i++)
+    {
+        OGRLinearRing *r = i ? p->getInteriorRing(static_cast<int>(i) - 1) : ext;
+        rings[i].resize(r->getNumPoints());
+        if (!rings[i].empty())
+            r->getPoints(rings[i].data());
+    }
 
-    //считаем минимальное расстояние от точек полигона до центроида
-    std::vector <double> distances;
-    for (int i = 0; i < pts->getNumGeometries(); i++)
+    double width = env.MaxX - env.MinX;
+    double height = env.MaxY - env.MinY;
+    double cellSize = std::min(width, height);
+    if (cellSize <= 0)
+        //вырожденный полигон
+        return std::make_tuple(center, -1.0);
+    //при precision <= 0 ячейки делились бы до исчезновения h,
+    //поэтому точность не меньше миллиардной доли размера полигона
+    precision = std::max(precision, cellSize * 1E-9);
+    double h = cellSize / 2;
+
+    //очередь ячеек, первой извлекается самая перспективная
+    std::priority_queue<PoleCell> cells;
+    for (double x = env.MinX;x < env.MaxX;x += cellSize)
+        for (double y = env.MinY;y < env.MaxY;y += cellSize)
+            cells.push(PoleCell(x + h, y + h, h, rings));
+
+    //начальное приближение - центр масс внешнего контура
+    const std::vector<OGRRawPoint> &er = rings[0];
+    double area = 0, cx = 0, cy = 0;
+    for (size_t i = 0, j = er.size() - 1;i < er.size();j = i++)
     {
-        auto point = pts->getGeometryRef(i);
-        distances.push_back(point->Distance(centroid));
+        double f = er[i].x*er[j].y - er[j].x*er[i].y;
+        cx += (er[i].x + er[j].x)*f;
+        cy += (er[i].y + er[j].y)*f;
+        area += f * 3;
     }
+    PoleCell best = (area == 0) ?
+        PoleCell(er[0].x, er[0].y, 0, rings) :
+        PoleCell(cx / area, cy / area, 0, rings);
+
+    //центр bounding box тоже может быть лучше
+    PoleCell bboxCell(center.x, center.y, 0, rings);
+    if (bboxCell.d > best.d)
+        best = bboxCell;
 
-    //возвращаем минимальное расстояние
-    return *std::min_element(std::begin(distances), std::end(distances));
+    while (!cells.empty())
+    {
+        PoleCell cell = cells.top();
+        cells.pop();
+
+        //нашли лучшую точку
+        if (cell.d > best.d)
+            best = cell;
+
+        //в ячейке не может быть заметно лучшей точки
+        if (cell.max - best.d <= precision)
+            continue;
+
+        //делим ячейку на 4
+        h = cell.h / 2;
+        cells.push(PoleCell(cell.x - h, cell.y - h, h, rings));
+        cells.push(PoleCell(cell.x + h, cell.y - h, h, rings));
+        cells.push(PoleCell(cell.x - h, cell.y + h, h, rings));
+        cells.push(PoleCell(cell.x + h, cell.y + h, h, rings));
+    }
+
+    if (best.d <= 0)
+        //не нашли точку внутри полигона
+        return std::make_tuple(center, -1.0);
+
+    return std::make_tuple(OGRRawPoint(best.x, best.y), best.d);
+}
+
+double InscribedCircleRadius(OGRPolygon * p, OGRPoint * center)
+{
+    //не принимаем nullptr
+    assert(p);
+    assert(center);
+
+    OGRLinearRing *ext = p->getExteriorRing();
+    if (!ext)
+        //нет внешнего контура, ошибка
+        return -1;
+
+    //минимальное расстояние от точек внешнего контура до центра
+    auto nearest = NearestVertex(ext, center->getX(), center->getY());
+    if (std::get<0>(nearest) < 0)
+        //нет точек, ошибка
+        return -1;
+
+    return sqrt(std::get<1>(nearest));
 }
 
 GDALDataset *OpenSHPFile(const std::string fname)
@@ -442,82 +654,137 @@ void FreeDatasets(std::vector<GDALDataset*> &inputDatasets)
 
 void AddPolygonsFromLayer(OGRMultiPolygon* &polygons, OGRLayer *layer)
 {
-    float prev_progress = 0.0;
-
 	assert(polygons != nullptr);
 	assert(layer != nullptr);
 
-	layer->ResetReading();
-	OGRFeature *currentFeature;
-	int featureCounter = 0;
-	while ((currentFeature = layer->GetNextFeature()) != nullptr)
+	//добавляем полигоны в наш набор без копирования
+	IngestPolygons(layer, [&polygons](OGRPolygon *p, OGRFeature*)
 	{
+		polygons->addGeometryDirectly(p);
+	}, true);
+}
 
-		float progress = (float)(++featureCounter) / (float)layer->GetFeatureCount() * 100.0;
-		//printf("\rprocessing feature...%d of %d (%.1f%%)\n", featureCounter,
-		//	layer->GetFeatureCount(), progress);
-		FancyProgress(progress,prev_progress);
-		//геометрия из входного файла
-		OGRGeometry *currentGeometry;
-		currentGeometry = currentFeature->GetGeometryRef();
-		//если нет геометрии в currentFeature, пропускаем его
-		if (!currentGeometry)
-		{
-			OGRFeature::DestroyFeature(currentFeature);
-			continue;
-		}
-		//если геометрия не того типа, пропускаем feature
-		if (currentGeometry->getGeometryType() != wkbPolygon)
-		{
-			OGRFeature::DestroyFeature(currentFeature);
-			continue;
-		}
-		//добавляем полигон в наш набор полигонов
-		polygons->addGeometry(currentGeometry);
-		OGRFeature::DestroyFeature(currentFeature);
-	}
+//геометрия feature, если это полигон. Полигон забирается
+//у feature, владельцем становится вызывающий.
+//nullptr, если геометрии нет или это не полигон
+static OGRPolygon *StealPolygon(OGRFeature *feature)
+{
+    //тип проверяем до того, как забрать геометрию
+    OGRGeometry *g = feature->GetGeometryRef();
+    if (!g || g->getGeometryType() != wkbPolygon)
+        return nullptr;
+    return static_cast<OGRPolygon*>(feature->StealGeometry());
+}
+
+int IngestPolygons(OGRLayer *layer, const PolygonHandler &handler,
+    bool verbose, bool takeFeatures)
+{
+    assert(layer != nullptr);
+
+    layer->ResetReading();
+    //число feature запрашиваем один раз, некоторые
+    //драйверы для этого читают весь слой
+    std::unique_ptr<ProgressIndicator> indicator;
+    if (verbose)
+        indicator.reset(new ProgressIndicator(
+            static_cast<int>(layer->GetFeatureCount()), "Reading layer"));
+
+    int count = 0;
+    OGRFeature *currentFeature;
+    while ((currentFeature = layer->GetNextFeature()) != nullptr)
+    {
+        if (indicator)
+            indicator->incOperationCount();
+        //берем только полигоны, геометрию забираем
+        //у feature, копия не нужна
+        OGRPolygon *p = StealPolygon(currentFeature);
+        if (p)
+        {
+            handler(p, currentFeature);
+            count++;
+            //feature теперь принадлежит обработчику
+            if (takeFeatures)
+                continue;
+        }
+        OGRFeature::DestroyFeature(currentFeature);
+    }
+    return count;
 }
 
-OGRMultiPolygon *FetchGeometryFromFiles(StringList files, std::string layerName)
+OGRMultiPolygon *FetchGeometryFromFiles(StringList files, std::string layerName,
+    int nthreads)
 {
-	vector<GDALDataset*> datasets;
 	OGRMultiPolygon *res = (OGRMultiPolygon*)
 		OGRGeometryFactory::createGeometry(wkbMultiPolygon);
-	//подгружаем файлы
-	LoadDatasets(files, datasets);
-	//из каждого файла забираем нужный слой
-	for (vector <GDALDataset*>::iterator i =
-		datasets.begin(); i != datasets.end(); i++)
-	{
-		//обходим dataset'ы, ищем нужный слой
-		//Dataset из входного файла S-57
-		GDALDataset *inputDataset = *i;
-		printf("processing file %s\n", inputDataset->GetFileList()[0]);
-		//нужный слой из Dataset входного файла S-57
-		OGRLayer *currentLayer =
-			inputDataset->GetLayerByName(layerName.c_str());
-		//нет нужного слоя
-		if (!currentLayer)
-		{
-			//выводим сообщение пользователю, что нет слоя SOURCE_LAYER в файле
-			//затем пропускаем dataset
-			char* fname = inputDataset->GetFileList()[0];
-			if (fname)
-				printf("file %s does not contain layer %s",
-					fname, layerName.c_str());
-			else
-				printf("layer error\n");
-			continue;
-		}
-		//есть нужный слой, обходим feature данного dataseta
-		AddPolygonsFromLayer(res, currentLayer);
-	}
-
 	assert(res != nullptr);
 
+	//файлы читаются параллельно, полигоны добавляются
+	//в порядке файлов без копирования
+	LoadPolygonsFromFiles(files, layerName, [res](OGRPolygon *p, OGRFeature*)
+	{
+		res->addGeometryDirectly(p);
+	}, nthreads);
+
 	return res;
 }
 
+int LoadPolygonsFromFiles(const StringList &files,
+    const std::string &layerName, const PolygonHandler &handler,
+    int nthreads)
+{
+    int nfiles = static_cast<int>(files.size());
+    int loaded = 0;
+
+    //файлы раздаются потокам по одному, открытие и разбор
+    //файла идут параллельно, а передача полигонов - в порядке
+    //файлов в секции ordered
+#pragma omp parallel for ordered schedule(dynamic, 1) \
+    num_threads(ThreadCount(nthreads))
+    for (int i = 0;i < nfiles;i++)
+    {
+        //каждый поток открывает свой dataset, dataset'ы GDAL
+        //нельзя использовать из нескольких потоков
+        GDALDataset *dataset = (GDALDataset*)GDALOpenEx(
+            files[i].c_str(), GDAL_OF_VECTOR, nullptr, nullptr, nullptr);
+        OGRLayer *layer = dataset ?
+            dataset->GetLayerByName(layerName.c_str()) : nullptr;
+
+        //полигоны файла вместе с feature, из которых они взяты.
+        //Описание полей feature принадлежит слою, поэтому
+        //dataset закрывается после передачи полигонов
+        std::vector< std::pair<OGRPolygon*, OGRFeature*> > buffer;
+        if (layer)
+            IngestPolygons(layer, [&buffer](OGRPolygon *p, OGRFeature *f)
+            {
+                buffer.push_back(std::make_pair(p, f));
+            }, false, true);
+
+#pragma omp ordered
+        {
+            if (!dataset)
+                cout << "Map: " << files[i] << " Error reading datasource" << std::endl;
+            else if (!layer)
+                cout << "file " << files[i] << " does not contain layer "
+                    << layerName << std::endl;
+            else
+            {
+                cout << "processing file " << files[i] << std::endl;
+                loaded++;
+            }
+            for (auto p = buffer.begin();p != buffer.end();p++)
+            {
+                handler((*p).first, (*p).second);
+                OGRFeature::DestroyFeature((*p).second);
+            }
+        }
+
+        if (dataset)
+            GDALClose(dataset);
+    }
+
+    return loaded;
+}
+
 void FancyProgress(float &progress,float &prev_progress)
 {
 	static bool first = true;
@@ -567,6 +834,44 @@ OGRMultiLineString* ExternalRingToMLS(OGRPolygon *input)
     return nullptr;
 }
 
+int ThreadCount(int requested)
+{
+    if (requested > 0)
+        return requested;
+#ifdef _OPENMP
+    return omp_get_max_threads();
+#else
+    return 1;
+#endif
+}
+
+bool TakeOption(StringList &args, const std::string &name, std::string &value)
+{
+    for (auto i = args.begin();i != args.end();i++)
+    {
+        if (*i != name) continue;
+
+        //у опции нет значения
+        if (i + 1 == args.end())
+            return false;
+
+        value = *(i + 1);
+        args.erase(i, i + 2);
+        return true;
+    }
+    return false;
+}
+
+bool TakeFlag(StringList &args, const std::string &name)
+{
+    auto i = std::find(args.begin(), args.end(), name);
+    if (i == args.end())
+        return false;
+
+    args.erase(i);
+    return true;
+}
+
 ProgressIndicator::ProgressIndicator(int max_operations,std::string _caption) :
     max_op(max_operations), caption(_caption), progress(0), prev_progress(0), 
     op_cnt(0)
@@ -660,68 +965,200 @@ bool WriteGeometryCollectionToFile(OGRGeometryCollection *collection, string fil
         GDALClose(outDataset);
         return false;
     }
-    //Записываем коллекцию
-    for (int i=0;i<collection->getNumGeometries();i++)
+    //Записываем коллекцию, геометрия остается в коллекции
+    bool ok = true;
     {
-        //записываем результат в файл
-        OGRFeature *poFeature;
-        poFeature = OGRFeature::CreateFeature(outLayer->GetLayerDefn());
-        //добавляем геометрию в feature
-        poFeature->SetGeometry(collection->getGeometryRef(i));
-        //записываем feature на диск
-        if (outLayer->CreateFeature(poFeature) != OGRERR_NONE)
-        {
-            std::cout << "Failed to create feature"
-                      << std::endl;
-            OGRFeature::DestroyFeature(poFeature);
-            GDALClose(outDataset);
-            return false;
-        }
-        OGRFeature::DestroyFeature(poFeature);
+        FeatureWriter writer(outLayer);
+        for (int i = 0;i < collection->getNumGeometries() && ok;i++)
+            ok = writer.write(collection->getGeometryRef(i));
+        ok = writer.commit() && ok;
     }
+    if (!ok)
+        std::cout << "Failed to create feature"
+                  << std::endl;
     //закрываем дескриптор файла
     GDALClose(outDataset);
-    return true;
+    return ok;
+}
+
+FeatureWriter::FeatureWriter(OGRLayer *layer, int batchSize,
+    bool transactions)
+    : m_layer(layer), m_batchSize(batchSize), m_pending(0)
+{
+    assert(layer);
+    assert(batchSize > 0);
+
+    m_feature = OGRFeature::CreateFeature(layer->GetLayerDefn());
+    m_transactions = transactions &&
+        layer->TestCapability(OLCTransactions) != FALSE;
+}
+
+FeatureWriter::~FeatureWriter()
+{
+    commit();
+    OGRFeature::DestroyFeature(m_feature);
+}
+
+bool FeatureWriter::flushFeature()
+{
+    //транзакция открывается перед первой записью пакета
+    if (m_transactions && m_pending == 0 &&
+        m_layer->StartTransaction() != OGRERR_NONE)
+        m_transactions = false;
+    //FID назначает драйвер, после прошлой записи он заполнен
+    m_feature->SetFID(OGRNullFID);
+    bool ok = m_layer->CreateFeature(m_feature) == OGRERR_NONE;
+    if (m_transactions && ++m_pending >= m_batchSize)
+        ok = commit() && ok;
+    return ok;
+}
+
+bool FeatureWriter::writeDirectly(OGRGeometry *g)
+{
+    m_feature->SetGeometryDirectly(g);
+    return flushFeature();
+}
+
+bool FeatureWriter::write(OGRGeometry *g)
+{
+    m_feature->SetGeometryDirectly(g);
+    bool ok = flushFeature();
+    //геометрия принадлежит вызывающему, забираем ее обратно
+    m_feature->StealGeometry();
+    return ok;
+}
+
+bool FeatureWriter::commit()
+{
+    if (!m_transactions || m_pending == 0)
+        return true;
+    m_pending = 0;
+    return m_layer->CommitTransaction() == OGRERR_NONE;
 }
 
 
+//диапазон ячеек [first, last], которые касаются отрезка [lo, hi],
+//lo и hi - координаты в единицах шага сетки от начала сетки.
+//Ячейка n занимает отрезок [n, n+1], границы включаются
+static void CellSpan(double lo, double hi, int count, int &first, int &last)
+{
+    first = std::max(0, static_cast<int>(ceil(lo)) - 1);
+    last = std::min(count - 1, static_cast<int>(floor(hi)));
+}
+
 OGRGeometryCollection *GenerateTilesInsidePolygon(OGRPolygon *inputPolygon, double gridSize)
 {
     using namespace Boilerplates;
-    //Контур полигона
-    std::shared_ptr<OGRMultiLineString> inputPolygonContour
-            (ExternalRingToMLS(inputPolygon));
+    assert(inputPolygon);
+    assert(gridSize > 0);
 
-    //Геометрическая коллекция из одного полигона
-    CreateSmartPtr(collection,GeometryCollection);
-    collection->addGeometry(inputPolygon);
+    //сетка та же, что и в GenerateGrid
+    OGREnvelope env;
+    inputPolygon->getEnvelope(&env);
+    RegularGrid g(env, gridSize);
+    int rows = g.rows(),
+            cols = g.cols();
+
+    OGRGeometryCollection *grid = newGeometryCollection();
+    if (rows <= 0 || cols <= 0)
+        return grid;
+
+    //для каждой строки сетки:
+    //диапазоны столбцов ячеек, которые касаются контуров полигона
+    std::vector< std::vector< std::pair<int, int> > > boundary(rows);
+    //точки пересечения контуров с линией, проходящей через
+    //центры ячеек строки
+    std::vector< std::vector<double> > crossings(rows);
+
+    //координаты в единицах шага сетки
+    auto u = [&](double x) { return (x - env.MinX) / gridSize; };
+    auto v = [&](double y) { return (env.MaxY - y) / gridSize; };
+    //y центров ячеек строки
+    auto rowCenter = [&](int r) { return env.MaxY - (r + 0.5)*gridSize; };
+
+    //один проход по ребрам всех контуров, включая внутренние
+    for (int ir = 0;ir <= inputPolygon->getNumInteriorRings();ir++)
+    {
+        OGRLinearRing *ring = ir ?
+            inputPolygon->getInteriorRing(ir - 1) :
+            inputPolygon->getExteriorRing();
+        if (!ring) continue;
 
-    //генерируем геометрию сетки
-    OGRGeometryCollection *grid = GenerateGrid(collection.get(), gridSize);
+        int npts = ring->getNumPoints();
+        std::vector<OGRRawPoint> pts(npts);
+        if (npts > 0)
+            ring->getPoints(pts.data());
 
-    //проверяем, что она действительно создалась
-    if (!grid)
-    {
-        std::cout << "Error when generating grid geometries"
-                  << std::endl;
+        for (int i = 0;i + 1 < npts;i++)
+        {
+            const OGRRawPoint &a = pts[i];
+            const OGRRawPoint &b = pts[i + 1];
+            double ylo = std::min(a.y, b.y);
+            double yhi = std::max(a.y, b.y);
+
+            //ячейки, которые касаются ребра, строка за строкой
+            int r0, r1;
+            CellSpan(v(yhi), v(ylo), rows, r0, r1);
+            for (int r = r0;r <= r1;r++)
+            {
+                //часть ребра внутри полосы строки
+                double bandLo = std::max(ylo, env.MaxY - (r + 1)*gridSize);
+                double bandHi = std::min(yhi, env.MaxY - r*gridSize);
+                double xa = a.x, xb = b.x;
+                if (a.y != b.y)
+                {
+                    double k = (b.x - a.x) / (b.y - a.y);
+                    xa = a.x + (bandLo - a.y)*k;
+                    xb = a.x + (bandHi - a.y)*k;
+                }
+                int c0, c1;
+                CellSpan(u(std::min(xa, xb)), u(std::max(xa, xb)), cols, c0, c1);
+                if (c0 <= c1)
+                    boundary[r].push_back(std::make_pair(c0, c1));
+            }
 
+            //пересечения с линиями центров строк
+            if (a.y == b.y) continue;
+            int s0, s1;
+            CellSpan(v(yhi) - 0.5, v(ylo) - 0.5, rows, s0, s1);
+            for (int r = s0;r <= s1;r++)
+            {
+                double yc = rowCenter(r);
+                if ((a.y > yc) != (b.y > yc))
+                    crossings[r].push_back(
+                        a.x + (yc - a.y)*(b.x - a.x) / (b.y - a.y));
+            }
+        }
     }
 
-    //исключаем из сетки те квадраты, которые имеют размеры, не кратные grid_sz
-    //и те, что не находятся полностью внутри полигона
-    int i = 0;
-    while (i<grid->getNumGeometries())
+    //ячейка, которой не касается ни один контур, целиком лежит
+    //по одну сторону от границы, поэтому достаточно проверить ее центр
+    for (int r = 0;r < rows;r++)
     {
-        OGRGeometry *current = grid->getGeometryRef(i);
-        //Если квадратик внутри полигона, но пересекает его контур, то убираем
-        //Если квадратик за пределами полигона, убираем его
-        if (!current->Intersects(inputPolygon) || current->Intersects(inputPolygonContour.get()))
+        std::vector< std::pair<int, int> > &b = boundary[r];
+        std::vector<double> &x = crossings[r];
+        std::sort(b.begin(), b.end());
+        std::sort(x.begin(), x.end());
+
+        size_t ib = 0;
+        //между парами пересечений - внутренность полигона
+        for (size_t k = 0;k + 1 < x.size();k += 2)
         {
-            grid->removeGeometry(i);
-            continue;
+            int c0 = std::max(0, static_cast<int>(ceil(u(x[k]) - 0.5)));
+            int c1 = std::min(cols - 1, static_cast<int>(floor(u(x[k + 1]) - 0.5)));
+            for (int c = c0;c <= c1;c++)
+            {
+                //пропускаем ячейки на границе
+                while (ib < b.size() && b[ib].second < c)
+                    ib++;
+                if (ib < b.size() && b[ib].first <= c)
+                {
+                    c = b[ib].second;
+                    continue;
+                }
+                grid->addGeometryDirectly(g.cell(r, c));
+            }
         }
-        //Идем к следующему полигону
-        i++;
     }
 
     return grid;
@@ -760,24 +1197,579 @@ OGRPolygon *CreateGridNode(OGRRawPoint &topLeft, double gridSize, int row, int c
     return CreateRectangle(newTopLeft, gridSize, gridSize);
 }
 
-OGRGeometryCollection *GenerateGrid(OGRGeometry *input, double gridSize)
+OGRPolygon *CreateCapsule(const OGRRawPoint &a, const OGRRawPoint &b,
+    double radius, int arcSegments)
+{
+    assert(radius > 0);
+    assert(arcSegments >= 2);
+
+    const double pi = 3.14159265358979323846;
+    double dx = b.x - a.x;
+    double dy = b.y - a.y;
+    //направление отрезка
+    double phi = atan2(dy, dx);
+    //шаг по углу в полукругах
+    double step = pi / arcSegments;
+
+    std::vector<OGRRawPoint> pts;
+    pts.reserve(2 * arcSegments + 3);
+    //точки полукруга вокруг center начиная с угла start
+    //против часовой стрелки
+    auto addArc = [&](const OGRRawPoint &center, double start, int n)
+    {
+        for (int i = 0;i < n;i++)
+        {
+            double t = start + i*step;
+            pts.push_back(OGRRawPoint(center.x + radius*cos(t),
+                center.y + radius*sin(t)));
+        }
+    };
+
+    if (dx == 0 && dy == 0)
+    {
+        //вырожденный отрезок - окружность
+        addArc(a, 0, 2 * arcSegments);
+    }
+    else
+    {
+        //полукруг вокруг b, затем вокруг a, концы полукругов
+        //соединяются сторонами прямоугольника
+        addArc(b, phi - pi / 2, arcSegments + 1);
+        addArc(a, phi + pi / 2, arcSegments + 1);
+    }
+    //замыкаем контур
+    pts.push_back(pts.front());
+
+    OGRLinearRing *rng = newLinearRing();
+    rng->setPoints(static_cast<int>(pts.size()), pts.data(), nullptr);
+    OGRPolygon *poly = newPolygon();
+    poly->addRingDirectly(rng);
+
+    return poly;
+}
+
+//контур в виде массива координат, последняя точка совпадает с первой
+typedef std::vector<OGRRawPoint> RawRing;
+
+//удвоенная ориентированная площадь контура, > 0 - против часовой
+static double RingArea2(const RawRing &r)
+{
+    double a = 0;
+    for (size_t i = 0;i + 1 < r.size();i++)
+        a += r[i].x*r[i + 1].y - r[i + 1].x*r[i].y;
+    return a;
+}
+
+//точка строго внутри контура (по правилу чет-нечет)
+static bool PointInRing(double x, double y, const RawRing &r)
+{
+    bool inside = false;
+    for (size_t i = 0, j = r.size() - 1;i < r.size();j = i++)
+    {
+        if ((r[i].y > y) != (r[j].y > y) &&
+            (x < (r[j].x - r[i].x)*(y - r[i].y) / (r[j].y - r[i].y) + r[i].x))
+            inside = !inside;
+    }
+    return inside;
+}
+
+//часть контура внутри прямоугольника: от точки входа
+//до точки выхода на границе прямоугольника
+struct ClipChain
+{
+    RawRing points;
+    //положение точек входа и выхода на периметре
+    double entry, exit;
+    bool used;
+};
+
+//отсечение отрезка ab прямоугольником (Лианг-Барски). Координаты
+//точек на границе приравниваются к координатам сторон.
+//Возвращает false, если от отрезка ничего не осталось.
+//clippedStart, clippedEnd - обрезан ли отрезок с начала или с конца
+static bool ClipSegment(const OGREnvelope &e, const OGRRawPoint &a,
+    const OGRRawPoint &b, OGRRawPoint &c0, OGRRawPoint &c1,
+    bool &clippedStart, bool &clippedEnd)
+{
+    double dx = b.x - a.x, dy = b.y - a.y;
+    double t0 = 0, t1 = 1;
+    //сторона, по которой обрезано начало и конец: 0..3, -1 - нет
+    int side0 = -1, side1 = -1;
+    const double p[4] = { -dx, dx, -dy, dy };
+    const double q[4] = { a.x - e.MinX, e.MaxX - a.x, a.y - e.MinY, e.MaxY - a.y };
+    for (int k = 0;k < 4;k++)
+    {
+        if (p[k] == 0)
+        {
+            if (q[k] < 0) return false;
+            continue;
+        }
+        double t = q[k] / p[k];
+        if (p[k] < 0)
+        {
+            if (t > t1) return false;
+            if (t > t0) { t0 = t; side0 = k; }
+        }
+        else
+        {
+            if (t < t0) return false;
+            if (t < t1) { t1 = t; side1 = k; }
+        }
+    }
+
+    clippedStart = t0 > 0;
+    clippedEnd = t1 < 1;
+    c0 = clippedStart ? OGRRawPoint(a.x + t0*dx, a.y + t0*dy) : a;
+    c1 = clippedEnd ? OGRRawPoint(a.x + t1*dx, a.y + t1*dy) : b;
+    //точки обрезки кладем точно на стороны
+    const double sides[4] = { e.MinX, e.MaxX, e.MinY, e.MaxY };
+    if (clippedStart)
+    {
+        if (side0 < 2) c0.x = sides[side0]; else c0.y = sides[side0];
+    }
+    if (clippedEnd)
+    {
+        if (side1 < 2) c1.x = sides[side1]; else c1.y = sides[side1];
+    }
+    //от отрезка осталась точка на границе
+    if ((clippedStart || clippedEnd) && c0.x == c1.x && c0.y == c1.y)
+        return false;
+    return true;
+}
+
+//положение точки на границе прямоугольника, обход против часовой
+//стрелки от левого нижнего угла, каждая сторона - единица длины
+static double PerimeterPosition(const OGREnvelope &e, const OGRRawPoint &pt)
+{
+    double w = e.MaxX - e.MinX, h = e.MaxY - e.MinY;
+    //ближайшая сторона
+    double d[4] = { fabs(pt.y - e.MinY), fabs(pt.x - e.MaxX),
+        fabs(pt.y - e.MaxY), fabs(pt.x - e.MinX) };
+    int side = static_cast<int>(std::min_element(d, d + 4) - d);
+    switch (side)
+    {
+    case 0: return (pt.x - e.MinX) / w;
+    case 1: return 1 + (pt.y - e.MinY) / h;
+    case 2: return 2 + (e.MaxX - pt.x) / w;
+    default:
+    {
+        double pos = 3 + (e.MaxY - pt.y) / h;
+        return pos >= 4 ? 0 : pos;
+    }
+    }
+}
+
+//отрезок лежит на одной стороне прямоугольника
+static bool OnSameSide(const OGREnvelope &e, const OGRRawPoint &a,
+    const OGRRawPoint &b)
+{
+    return (a.x == e.MinX && b.x == e.MinX) || (a.x == e.MaxX && b.x == e.MaxX) ||
+        (a.y == e.MinY && b.y == e.MinY) || (a.y == e.MaxY && b.y == e.MaxY);
+}
+
+//добавление точки в контур без повторов
+static void PushPoint(RawRing &r, const OGRRawPoint &pt)
+{
+    if (r.empty() || r.back().x != pt.x || r.back().y != pt.y)
+        r.push_back(pt);
+}
+
+//деление контура на части внутри прямоугольника. Если контур
+//целиком внутри, он добавляется в closed. Части, которые
+//стягиваются в точку (касание границы снаружи), отбрасываются.
+//Возвращает false, если контур не заходит внутрь прямоугольника
+static bool ClipRing(const OGREnvelope &e, const RawRing &ring,
+    std::vector<ClipChain> &chains, std::vector<RawRing> &closed)
+{
+    size_t n = ring.size() - 1;
+    //для каждого ребра: обрезанный отрезок и признаки обрезки
+    struct Piece { OGRRawPoint c0, c1; bool inside, cs, ce; };
+    std::vector<Piece> pieces(n);
+    for (size_t i = 0;i < n;i++)
+    {
+        Piece &pc = pieces[i];
+        pc.inside = ClipSegment(e, ring[i], ring[i + 1], pc.c0, pc.c1, pc.cs, pc.ce);
+        //отрезок на границе прямоугольника - разрыв, его при
+        //необходимости восстановит обход периметра
+        if (pc.inside && OnSameSide(e, pc.c0, pc.c1) &&
+            (pc.c0.x != pc.c1.x || pc.c0.y != pc.c1.y))
+            pc.inside = false;
+    }
+
+    //ребро, перед которым заканчивается часть: предыдущее
+    //ребро снаружи или обрезано в конце, либо само обрезано в начале
+    size_t start = n;
+    for (size_t i = 0;i < n && start == n;i++)
+    {
+        const Piece &prev = pieces[(i + n - 1) % n];
+        if (!prev.inside || prev.ce || pieces[i].cs)
+            start = i;
+    }
+
+    //контур целиком внутри
+    if (start == n)
+    {
+        closed.push_back(ring);
+        return true;
+    }
+
+    //части из одной точки с точностью до погрешности
+    double eps = 1e-9*std::max(e.MaxX - e.MinX, e.MaxY - e.MinY);
+    bool found = false;
+    auto flush = [&](ClipChain &c)
+    {
+        if (c.points.empty()) return;
+        const OGRRawPoint &p0 = c.points.front();
+        bool extent = false;
+        for (auto pt = c.points.begin();pt != c.points.end() && !extent;pt++)
+            extent = fabs(pt->x - p0.x) > eps || fabs(pt->y - p0.y) > eps;
+        if (extent)
+        {
+            chains.push_back(c);
+            found = true;
+        }
+        c.points.clear();
+    };
+
+    //обход начинаем с разрыва, чтобы части
+    //не переходили через конец массива
+    ClipChain cur;
+    cur.used = false;
+    for (size_t k = 0;k < n;k++)
+    {
+        const Piece &pc = pieces[(start + k) % n];
+        if (!pc.inside)
+        {
+            flush(cur);
+            continue;
+        }
+        if (pc.cs)
+            flush(cur);
+        PushPoint(cur.points, pc.c0);
+        PushPoint(cur.points, pc.c1);
+        if (pc.ce)
+            flush(cur);
+    }
+    flush(cur);
+
+    return found;
+}
+
+//контур из координат
+static OGRLinearRing *MakeRing(RawRing &r)
+{
+    OGRLinearRing *rng = Boilerplates::newLinearRing();
+    rng->setPoints(static_cast<int>(r.size()), r.data(), nullptr);
+    return rng;
+}
+
+//отсечение полигона прямоугольником по координатам контуров
+//(Вейлер-Атертон для прямоугольника). Результат - внешние
+//контуры против часовой стрелки и дырки по часовой.
+//Возвращает false, если топология контуров нарушена
+static bool ClipRings(OGRPolygon *p, const OGREnvelope &rect,
+    std::vector<RawRing> &shells, std::vector<RawRing> &holes)
+{
+    //контуры: внешний против часовой стрелки, внутренние по часовой,
+    //т.е. внутренность полигона всегда слева
+    std::vector<ClipChain> chains;
+    std::vector<RawRing> closed;
+    //контуры, которые не заходят внутрь прямоугольника
+    std::vector<RawRing> outside;
+    for (int ir = 0;ir <= p->getNumInteriorRings();ir++)
+    {
+        OGRLinearRing *src = ir ? p->getInteriorRing(ir - 1) : p->getExteriorRing();
+        if (!src || src->getNumPoints() < 4) continue;
+        RawRing r(src->getNumPoints());
+        src->getPoints(r.data());
+        if (r.front().x != r.back().x || r.front().y != r.back().y)
+            r.push_back(r.front());
+        if ((ir == 0) != (RingArea2(r) > 0))
+            std::reverse(r.begin(), r.end());
+
+        if (!ClipRing(rect, r, chains, closed))
+            outside.push_back(r);
+    }
+
+    //углы прямоугольника, k-й угол на периметре в положении k+1
+    const OGRRawPoint corners[4] = {
+        OGRRawPoint(rect.MaxX, rect.MinY), OGRRawPoint(rect.MaxX, rect.MaxY),
+        OGRRawPoint(rect.MinX, rect.MaxY), OGRRawPoint(rect.MinX, rect.MinY) };
+
+    if (chains.empty())
+    {
+        //границы не пересекаются: прямоугольник без контуров,
+        //лежащих целиком внутри него, либо внутри полигона, либо
+        //снаружи. Проверяем по центру остальные контуры
+        double cx = (rect.MinX + rect.MaxX) / 2, cy = (rect.MinY + rect.MaxY) / 2;
+        bool covered = false;
+        for (auto r = outside.begin();r != outside.end();r++)
+            if (PointInRing(cx, cy, *r)) covered = !covered;
+        if (covered)
+        {
+            RawRing r(1, corners[3]);
+            r.insert(r.end(), corners, corners + 4);
+            shells.push_back(r);
+        }
+    }
+
+    for (auto c = chains.begin();c != chains.end();c++)
+    {
+        (*c).entry = PerimeterPosition(rect, (*c).points.front());
+        (*c).exit = PerimeterPosition(rect, (*c).points.back());
+    }
+
+    //собираем контуры: идем по части до выхода, затем по периметру
+    //против часовой стрелки до ближайшего входа
+    for (size_t first = 0;first < chains.size();first++)
+    {
+        if (chains[first].used) continue;
+        RawRing r;
+        size_t cur = first;
+        for (size_t guard = 0;;guard++)
+        {
+            //каждая часть используется один раз
+            if (guard > chains.size())
+                return false;
+            ClipChain &c = chains[cur];
+            c.used = true;
+            for (auto pt = c.points.begin();pt != c.points.end();pt++)
+                PushPoint(r, *pt);
+
+            //ближайший вход по периметру
+            size_t next = chains.size();
+            double best = 4;
+            for (size_t j = 0;j < chains.size();j++)
+            {
+                if (chains[j].used && j != first) continue;
+                double d = chains[j].entry - c.exit;
+                if (d < 0) d += 4;
+                if (d < best)
+                {
+                    best = d;
+                    next = j;
+                }
+            }
+            if (next == chains.size())
+                return false;
+
+            //углы между выходом и входом, по порядку обхода
+            int k0 = static_cast<int>(floor(c.exit));
+            for (int m = 0;m < 4;m++)
+            {
+                int k = (k0 + m) % 4;
+                double d = (k + 1) - c.exit;
+                if (d < 0) d += 4;
+                if (d <= 0 || d >= best) continue;
+                PushPoint(r, corners[k]);
+            }
+
+            if (next == first)
+                break;
+            cur = next;
+        }
+        PushPoint(r, r.front());
+        shells.push_back(r);
+    }
+
+    //контуры целиком внутри прямоугольника
+    for (auto r = closed.begin();r != closed.end();r++)
+    {
+        if (RingArea2(*r) > 0)
+            shells.push_back(*r);
+        else
+            holes.push_back(*r);
+    }
+
+    return true;
+}
+
+OGRGeometry *ClipPolygonByRectangle(OGRPolygon *p, const OGREnvelope &rect)
+{
+    assert(p);
+
+    OGREnvelope pe;
+    p->getEnvelope(&pe);
+    if (!pe.Intersects(rect))
+        return nullptr;
+
+    double rectArea = (rect.MaxX - rect.MinX)*(rect.MaxY - rect.MinY);
+    if (rectArea <= 0)
+        return nullptr;
+
+    std::vector<RawRing> shells, holes;
+    if (!ClipRings(p, rect, shells, holes))
+    {
+        //не получилось, считаем пересечение через GEOS
+        OGRRawPoint topLeft(rect.MinX, rect.MaxY);
+        MakeSmartPtr(r, Polygon, CreateRectangle(topLeft,
+            rect.MaxX - rect.MinX, rect.MaxY - rect.MinY));
+        OGRGeometry *res = p->Intersection(r.get());
+        if (res && (res->getGeometryType() == wkbPolygon ||
+            res->getGeometryType() == wkbMultiPolygon))
+            return res;
+        if (res)
+            destroy(res);
+        return nullptr;
+    }
+
+    //контуры меньше этой площади считаем вырожденными
+    double sliver = 1e-12*rectArea;
+    auto degenerate = [sliver](const RawRing &r)
+    {
+        return r.size() < 4 || fabs(RingArea2(r)) / 2 <= sliver;
+    };
+    shells.erase(std::remove_if(shells.begin(), shells.end(), degenerate),
+        shells.end());
+    holes.erase(std::remove_if(holes.begin(), holes.end(), degenerate),
+        holes.end());
+    if (shells.empty())
+        return nullptr;
+
+    //полигоны результата, дырки раскладываем по внешним контурам
+    std::vector<OGRPolygon*> polys;
+    for (auto r = shells.begin();r != shells.end();r++)
+    {
+        OGRPolygon *poly = newPolygon();
+        poly->addRingDirectly(MakeRing(*r));
+        polys.push_back(poly);
+    }
+    for (auto h = holes.begin();h != holes.end();h++)
+    {
+        //середина первого ребра дырки не лежит на внешнем контуре
+        double hx = ((*h)[0].x + (*h)[1].x) / 2, hy = ((*h)[0].y + (*h)[1].y) / 2;
+        for (size_t i = 0;i < shells.size();i++)
+            if (PointInRing(hx, hy, shells[i]))
+            {
+                polys[i]->addRingDirectly(MakeRing(*h));
+                break;
+            }
+    }
+
+    if (polys.size() == 1)
+        return polys[0];
+    OGRMultiPolygon *res = newMultiPolygon();
+    for (auto i = polys.begin();i != polys.end();i++)
+        res->addGeometryDirectly(*i);
+    return res;
+}
+
+PreparedGeometry::PreparedGeometry(OGRGeometry *g)
+    : m_geometry(g), m_prepared(nullptr)
+{
+    assert(g);
+
+    if (OGRHasPreparedGeometrySupport())
+        m_prepared = OGRCreatePreparedGeometry(g);
+}
+
+PreparedGeometry::~PreparedGeometry()
+{
+    if (m_prepared)
+        OGRDestroyPreparedGeometry(m_prepared);
+}
+
+bool PreparedGeometry::intersects(OGRGeometry *other) const
+{
+    assert(other);
+
+    if (m_prepared)
+        return OGRPreparedGeometryIntersects(m_prepared, other) != FALSE;
+    //нет поддержки подготовленной геометрии
+    return m_geometry->Intersects(other) != FALSE;
+}
+
+RegularGrid::RegularGrid(OGRGeometry *input, double gridSize)
 {
     assert(input);
-    using namespace Boilerplates;
-    //создаем сетку
-    CreatePtr(grid,GeometryCollection);
+    assert(gridSize > 0);
+
     //берем BoundingBox входной карты
     OGREnvelope env;
     input->getEnvelope(&env);
-    OGRRawPoint topLeft(env.MinX, env.MaxY);
+    m_topLeft = OGRRawPoint(env.MinX, env.MaxY);
+    m_gridSize = gridSize;
     //число строк и столбцов сетки
     auto count = GridSteps(input, gridSize);
-    int rows = std::get<0>(count),
-            cols = std::get<1>(count);
-    for (int row = 0; row < rows; row++)
-        for (int col = 0; col < cols; col++)
+    m_rows = std::get<0>(count);
+    m_cols = std::get<1>(count);
+}
+
+RegularGrid::RegularGrid(const OGREnvelope &env, double gridSize)
+{
+    assert(gridSize > 0);
+
+    m_topLeft = OGRRawPoint(env.MinX, env.MaxY);
+    m_gridSize = gridSize;
+    //так же, как в GridSteps
+    m_cols = static_cast<int>(ceil((env.MaxX - env.MinX) / gridSize));
+    m_rows = static_cast<int>(ceil((env.MaxY - env.MinY) / gridSize));
+}
+
+OGREnvelope RegularGrid::cellEnvelope(int row, int col) const
+{
+    OGREnvelope e;
+    e.MinX = m_topLeft.x + col*m_gridSize;
+    e.MaxX = e.MinX + m_gridSize;
+    e.MaxY = m_topLeft.y - row*m_gridSize;
+    e.MinY = e.MaxY - m_gridSize;
+    return e;
+}
+
+OGRPolygon *RegularGrid::cell(int row, int col) const
+{
+    assert(row >= 0 && row < m_rows);
+    assert(col >= 0 && col < m_cols);
+
+    OGRRawPoint topLeft(m_topLeft);
+    return CreateGridNode(topLeft, m_gridSize, row, col);
+}
+
+RegularGrid::CellRange RegularGrid::allCells() const
+{
+    CellRange r;
+    r.firstRow = 0;
+    r.lastRow = m_rows - 1;
+    r.firstCol = 0;
+    r.lastCol = m_cols - 1;
+    return r;
+}
+
+RegularGrid::CellRange RegularGrid::cellsTouching(const OGREnvelope &env) const
+{
+    //координаты в единицах шага сетки
+    CellRange r;
+    CellSpan((m_topLeft.y - env.MaxY) / m_gridSize,
+        (m_topLeft.y - env.MinY) / m_gridSize, m_rows, r.firstRow, r.lastRow);
+    CellSpan((env.MinX - m_topLeft.x) / m_gridSize,
+        (env.MaxX - m_topLeft.x) / m_gridSize, m_cols, r.firstCol, r.lastCol);
+    return r;
+}
+
+OGREnvelope RegularGrid::rangeEnvelope(const CellRange &range) const
+{
+    assert(!range.empty());
+
+    //берем границы самих крайних ячеек, чтобы они совпадали
+    //с cellEnvelope без погрешности
+    OGREnvelope e = cellEnvelope(range.firstRow, range.firstCol);
+    OGREnvelope last = cellEnvelope(range.lastRow, range.lastCol);
+    e.MaxX = last.MaxX;
+    e.MinY = last.MinY;
+    return e;
+}
+
+OGRGeometryCollection *GenerateGrid(OGRGeometry *input, double gridSize)
+{
+    assert(input);
+    using namespace Boilerplates;
+    //создаем сетку
+    CreatePtr(grid,GeometryCollection);
+    RegularGrid g(input, gridSize);
+    for (int row = 0; row < g.rows(); row++)
+        for (int col = 0; col < g.cols(); col++)
             //Создаем элемент сетки
-            grid->addGeometryDirectly(CreateGridNode(topLeft, gridSize, row, col));
+            grid->addGeometryDirectly(g.cell(row, col));
 
     return grid;
 }
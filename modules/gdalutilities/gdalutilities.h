@@ -18,6 +18,7 @@
 #include <list>
 #include <memory>
 #include <tuple>
+#include <functional>
 
 namespace GDALUtilities
 {
@@ -125,6 +126,123 @@ namespace GDALUtilities
     ///Создание элемента сетки
     OGRPolygon *CreateGridNode(OGRRawPoint &topLeft, double gridSize, int row, int col);
 
+    /*!
+    \brief Создание полигона-капсулы
+    \details Капсула - отрезок ab, буферизованный на radius:
+    прямоугольник и два полукруга на концах. Координаты
+    контура рассчитываются сразу, без вызова GEOS Buffer.
+    Если a и b совпадают, получается окружность.
+    \param[in] a Начало отрезка
+    \param[in] b Конец отрезка
+    \param[in] radius Радиус капсулы, должен быть больше 0
+    \param[in] arcSegments Число отрезков в каждом полукруге,
+    не меньше 2. 60 соответствует OGRGeometry::Buffer по умолчанию.
+    \return Новый полигон
+    */
+    OGRPolygon *CreateCapsule(const OGRRawPoint &a, const OGRRawPoint &b,
+        double radius, int arcSegments = 60);
+
+    /*!
+    \brief Подготовленная геометрия
+    \details Обертка над GEOS PreparedGeometry. Структуры GEOS
+    для геометрии строятся один раз в конструкторе, после чего
+    многократные проверки пересечения с другими геометриями
+    выполняются значительно быстрее OGRGeometry::Intersects.
+    Если GDAL собран без поддержки подготовленной геометрии,
+    используется обычный Intersects.
+    */
+    class PreparedGeometry
+    {
+        ///исходная геометрия, не принадлежит объекту
+        OGRGeometry *m_geometry;
+        ///подготовленная геометрия, nullptr если нет поддержки
+        OGRPreparedGeometry *m_prepared;
+
+        PreparedGeometry(const PreparedGeometry &);
+        PreparedGeometry &operator=(const PreparedGeometry &);
+    public:
+        ///\param[in] g Исходная геометрия. Не допускается nullptr.
+        ///Должна существовать, пока существует объект.
+        explicit PreparedGeometry(OGRGeometry *g);
+        ~PreparedGeometry();
+        ///Проверка пересечения с геометрией other
+        bool intersects(OGRGeometry *other) const;
+    };
+
+    /*!
+    \brief Пересечение полигона с прямоугольником
+    \details Специализированная замена OGRGeometry::Intersection
+    для прямоугольника, работает с координатами контуров без GEOS.
+    Части контуров внутри прямоугольника соединяются обходом его
+    периметра, учитываются внутренние контуры. Участки контуров,
+    лежащие на границе прямоугольника, и вырожденные (нулевой
+    площади) части результата отбрасываются. Если контуры полигона
+    невалидны и собрать результат не удалось, пересечение
+    считается через GEOS.
+    \param[in] p Исходный полигон. Не допускается nullptr.
+    \param[in] rect Прямоугольник
+    \return Новый OGRPolygon или OGRMultiPolygon, nullptr если
+    пересечение не имеет площади.
+    */
+    OGRGeometry *ClipPolygonByRectangle(OGRPolygon *p, const OGREnvelope &rect);
+
+    /*!
+    \brief Регулярная сетка
+    \details Сетка с квадратными ячейками, которая покрывает
+    bounding box исходной геометрии. В отличие от GenerateGrid,
+    геометрии ячеек не хранятся, а создаются по запросу по номеру
+    строки и столбца. Строки нумеруются сверху вниз от MaxY,
+    столбцы слева направо от MinX.
+    */
+    class RegularGrid
+    {
+        ///левый верхний угол сетки
+        OGRRawPoint m_topLeft;
+        ///шаг сетки
+        double m_gridSize;
+        ///число строк и столбцов
+        int m_rows, m_cols;
+    public:
+        ///Диапазон ячеек сетки, границы включаются
+        struct CellRange
+        {
+            int firstRow, lastRow;
+            int firstCol, lastCol;
+            bool empty() const
+            {
+                return firstRow > lastRow || firstCol > lastCol;
+            }
+        };
+
+        ///Сетка, покрывающая геометрию input, как в GenerateGrid
+        RegularGrid(OGRGeometry *input, double gridSize);
+        ///Сетка, покрывающая bounding box
+        RegularGrid(const OGREnvelope &env, double gridSize);
+
+        int rows() const { return m_rows; }
+        int cols() const { return m_cols; }
+        ///Общее число ячеек
+        long long size() const
+        {
+            return static_cast<long long>(m_rows)*m_cols;
+        }
+        double gridSize() const { return m_gridSize; }
+        const OGRRawPoint &topLeft() const { return m_topLeft; }
+
+        ///Bounding box ячейки
+        OGREnvelope cellEnvelope(int row, int col) const;
+        ///Новый полигон - ячейка сетки
+        OGRPolygon *cell(int row, int col) const;
+        ///Все ячейки сетки
+        CellRange allCells() const;
+        ///Ячейки, которые касаются bounding box (включая
+        ///ячейки, имеющие с ним только общую границу)
+        CellRange cellsTouching(const OGREnvelope &env) const;
+        ///Bounding box диапазона ячеек, совпадает с границами
+        ///крайних ячеек диапазона
+        OGREnvelope rangeEnvelope(const CellRange &range) const;
+    };
+
     /*!
     \brief Генерация сетки.
     \details Создается сетка с регулярным шагом, которая
@@ -263,6 +381,38 @@ namespace GDALUtilities
     */
     OGRMultiPoint *FetchPointsFromPolygon(OGRPolygon *p);
 
+    /*!
+    \brief Ближайшая к точке вершина ломаной
+    \details Координаты вершин читаются из ломаной одним
+    массивом OGRRawPoint, минимум квадрата расстояния ищется
+    векторизованным циклом. Объекты OGRPoint не создаются.
+    \param[in] line Ломаная, например внешний контур полигона.
+    Не допускается nullptr.
+    \param[in] x,y Координаты точки
+    \return <номер ближайшей вершины, квадрат расстояния до нее>.
+    Номер -1, если в ломаной нет вершин.
+    */
+    std::tuple<int, double> NearestVertex(OGRSimpleCurve *line,
+        double x, double y);
+
+    /*!
+    \brief Полюс недоступности полигона
+    \details Точка внутри полигона, наиболее удаленная от его
+    границы (алгоритм polylabel). Плоскость покрывается квадратными
+    ячейками, ячейки с наибольшим возможным расстоянием до границы
+    делятся на 4, пока выигрыш не станет меньше precision.
+    Расстояние считается по координатам всех контуров, включая
+    внутренние, без вызовов GEOS.
+    \param[in] p Исходный полигон. Не допускается nullptr.
+    \param[in] precision Точность расчета в единицах карты.
+    Значения меньше 1E-9 меньшей стороны bounding box (в том числе
+    неположительные) заменяются на эту величину.
+    \return <точка, радиус вписанной окружности с центром в ней>.
+    Радиус -1, если полигон пустой или вырожденный.
+    */
+    std::tuple<OGRRawPoint, double> PoleOfInaccessibility(OGRPolygon *p,
+        double precision);
+
     /*!
     \brief Радиус вписанной в полигон окружности
     \details Радиус рассчитывается как расстояние от 
@@ -273,6 +423,19 @@ namespace GDALUtilities
     */
     double InscribedCircleRadius(OGRPolygon *p);
 
+    /*!
+    \brief Радиус вписанной в полигон окружности
+    с заранее рассчитанным центром
+    \details Радиус рассчитывается как расстояние от
+    center до ближайшей к нему точки полигона.
+    \param[in] p Исходный полигон. Не допускается nullptr.
+    \param[in] center Центр окружности, например результат
+    FailsafeCentroid. Не допускается nullptr.
+    \return Радиус вписанной окружности в единицах карты,
+    или -1 в случае ошибки.
+    */
+    double InscribedCircleRadius(OGRPolygon *p, OGRPoint *center);
+
     /*!
      * \brief ConstructPolygon
      * \param points Массив точек <x,y>
@@ -362,6 +525,32 @@ namespace GDALUtilities
     */
     void AddPolygonsFromLayer(OGRMultiPolygon* &polygons, OGRLayer *layer);
 
+    /*!
+    \brief Обработчик полигона, прочитанного из слоя.
+    \details Первый параметр - полигон, владельцем которого становится
+    обработчик. Второй - feature, из которого взят полигон, он нужен
+    только для чтения атрибутов и уничтожается после вызова.
+    */
+    typedef std::function<void(OGRPolygon*, OGRFeature*)> PolygonHandler;
+
+    /*!
+    \brief Чтение полигонов слоя без копирования геометрии
+    \details Геометрия забирается у каждого feature через
+    OGRFeature::StealGeometry и передается обработчику, поэтому
+    полигоны не копируются. Feature без геометрии или с геометрией
+    не типа wkbPolygon пропускаются.
+    \param[in] layer Слой. Не допускается nullptr.
+    \param[in] handler Обработчик полигонов
+    \param[in] verbose Если true, в консоли отображается прогресс
+    \param[in] takeFeatures Если true, обработчик становится владельцем
+    feature полигона и сам удаляет его (OGRFeature::DestroyFeature),
+    например, чтобы прочитать атрибуты позже. Feature, которые
+    пропускаются, удаляются в любом случае.
+    \return Число прочитанных полигонов
+    */
+    int IngestPolygons(OGRLayer *layer, const PolygonHandler &handler,
+        bool verbose = false, bool takeFeatures = false);
+
     /*!
     \brief Создание коллекции полигонов из нескольких файлов.
     \details Из каждого файла в списке files загружается слой с названием
@@ -369,12 +558,35 @@ namespace GDALUtilities
     Если файл не существует, или в нем нет указанного слоя, то файл пропускается.
     Если в нужном слое файла нет полигонов, или слой содержит
     не полигоны, то геометрия с данного файла не добавляется.
+    \details Файлы читаются параллельно (LoadPolygonsFromFiles),
+    порядок полигонов от числа потоков не зависит.
     \param[in] files Список файлов. Может быть пустым.
     \param[in] layerName Название слоя, который будет загружаться из файла.
+    \param[in] nthreads Число потоков, 0 - по числу ядер
     \return Новая коллекция полигонов. Не может быть nullptr.
     Может быть пустой.
     */
-    OGRMultiPolygon *FetchGeometryFromFiles(StringList files, std::string layerName);
+    OGRMultiPolygon *FetchGeometryFromFiles(StringList files, std::string layerName,
+        int nthreads = 0);
+
+    /*!
+    \brief Параллельное чтение полигонов из нескольких файлов
+    \details Файлы открываются и читаются в нескольких потоках,
+    у каждого потока свой GDALDataset. Полигоны забираются у feature
+    без копирования, как в IngestPolygons, и передаются handler'у
+    в порядке файлов в files и feature в слое, поэтому результат не
+    зависит от числа потоков. handler вызывается по одному разу за
+    раз, синхронизация в нем не нужна. Файлы, которые не удалось
+    открыть или в которых нет слоя layerName, пропускаются.
+    \param[in] files Список файлов. Может быть пустым.
+    \param[in] layerName Название слоя
+    \param[in] handler Обработчик полигонов
+    \param[in] nthreads Число потоков, 0 - по числу ядер
+    \return Число файлов, из которых прочитан слой
+    */
+    int LoadPolygonsFromFiles(const StringList &files,
+        const std::string &layerName, const PolygonHandler &handler,
+        int nthreads = 0);
 
     /*!
      * \brief Запись геометрической коллекции в файл
@@ -388,10 +600,103 @@ namespace GDALUtilities
                                        std::string fileName,
                                        std::string layerName = std::string("Default layer"),
                                        std::string driverName = std::string("ESRI Shapefile"));
+
+    /*!
+    \brief Пакетная запись feature в слой
+    \details Для всех записей используется один объект OGRFeature,
+    геометрия передается в него без копирования. Если слой
+    поддерживает транзакции (OLCTransactions), каждые batchSize
+    записей выполняются в одной транзакции. Незавершенная
+    транзакция фиксируется в commit() или в деструкторе.
+    Если записи выполняются внутри транзакции датасета, собственные
+    транзакции writer'а отключаются параметром конструктора.
+    Атрибуты записи задаются через feature() перед вызовом write.
+    */
+    class FeatureWriter
+    {
+        ///слой, в который пишем
+        OGRLayer *m_layer;
+        ///feature, который используется для всех записей
+        OGRFeature *m_feature;
+        ///число записей в одной транзакции
+        int m_batchSize;
+        ///число записей в текущей транзакции
+        int m_pending;
+        ///поддерживает ли слой транзакции
+        bool m_transactions;
+
+        FeatureWriter(const FeatureWriter&) = delete;
+        FeatureWriter &operator=(const FeatureWriter&) = delete;
+
+        ///запись m_feature в слой
+        bool flushFeature();
+    public:
+        /*!
+        \param[in] layer Слой. Не допускается nullptr.
+        \param[in] batchSize Число записей в одной транзакции
+        \param[in] transactions false - не открывать транзакции слоя,
+        например, если вызывающий уже открыл транзакцию датасета
+        */
+        explicit FeatureWriter(OGRLayer *layer, int batchSize = 10000,
+            bool transactions = true);
+        ~FeatureWriter();
+
+        ///Feature для атрибутов следующей записи
+        OGRFeature *feature() { return m_feature; }
+        /*!
+        \brief Запись геометрии, владельцем которой становится writer
+        \return false, если запись не удалась
+        */
+        bool writeDirectly(OGRGeometry *g);
+        /*!
+        \brief Запись геометрии без передачи владения
+        \details Геометрия не копируется, после записи она
+        забирается из feature обратно.
+        \return false, если запись не удалась
+        */
+        bool write(OGRGeometry *g);
+        /*!
+        \brief Фиксация текущей транзакции
+        \return false, если фиксация не удалась
+        */
+        bool commit();
+    };
     /*!
     @}
     */
 
+    /*!
+    \brief Число потоков для параллельных алгоритмов
+    \details Параллельные участки используют OpenMP. Если проект
+    собран без OpenMP, то всегда возвращается 1.
+    \param[in] requested Запрошенное число потоков. Если 0 или меньше,
+    то используется число потоков OpenMP по умолчанию (по числу ядер).
+    \return Число потоков, которое нужно использовать
+    */
+    int ThreadCount(int requested = 0);
+
+    /*!
+    \brief Извлечение именованной опции из аргументов командной строки
+    \details Ищет в args пару "name value", удаляет ее из args
+    и записывает value. Оставшиеся аргументы можно разбирать
+    как позиционные.
+    \param[in,out] args Аргументы командной строки
+    \param[in] name Имя опции, например "-threads"
+    \param[out] value Значение опции
+    \return true, если опция найдена
+    */
+    bool TakeOption(StringList &args, const std::string &name,
+        std::string &value);
+
+    /*!
+    \brief Извлечение флага из аргументов командной строки
+    \details Ищет в args аргумент name и удаляет его из args.
+    \param[in,out] args Аргументы командной строки
+    \param[in] name Имя флага, например "-delaunay"
+    \return true, если флаг найден
+    */
+    bool TakeFlag(StringList &args, const std::string &name);
+
     /*!
     \brief Красивый вывод прогресса в консоль
     \details Кросплатформенная функция вывода красивого
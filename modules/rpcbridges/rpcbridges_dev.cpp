@@ -34,28 +34,18 @@ void BridgesRPC::SaveTmp(std::string fname,OGC *g)
         printf("Could not create layer in SHP file!\n");
         return;
     }
-    for (int i = 0;i < g->getNumGeometries();i++)
     {
-        //создаем feature с геометрией
-        OGRFeature *outputFeature;
-        outputFeature = OGRFeature::CreateFeature(outLayer->GetLayerDefn());
-        if (!outputFeature)
+        //геометрия остается в коллекции, feature не копирует ее
+        GDALUtilities::FeatureWriter writer(outLayer);
+        for (int i = 0;i < g->getNumGeometries();i++)
         {
-            printf("Could not create test data!\n");
-            return;
-        }
-        assert(outputFeature != nullptr);
-        outputFeature->SetGeometry(g->getGeometryRef(i));
-        //записываем фичу на диск
-        if (outLayer->CreateFeature(outputFeature) != OGRERR_NONE)
-        {
-            //не смогли записать фичу, аварийно завершаем программу
-            printf("failed to write feature to output file!\n");
-            OGRFeature::DestroyFeature(outputFeature);
-            GDALClose(outDataset);
+            //записываем фичу на диск
+            if (!writer.write(g->getGeometryRef(i)))
+            {
+                printf("failed to write feature to output file!\n");
+                break;
+            }
         }
-
-        OGRFeature::DestroyFeature(outputFeature);
     }
 
     GDALClose(outDataset);
@@ -131,102 +121,314 @@ double BridgesRPC::DistanceBetweenPolygons(OGRPolygon *a, OGRPolygon *b)
 #endif 
 #ifdef BRIDGES_STUB_DISTANCE
         //считаем самостоятельно (велосипед)
-        OGRPoint *ppi = GDALUtilities::FailsafeCentroid(a);
-        OGRPoint *ppj = GDALUtilities::FailsafeCentroid(b);
-        assert(ppi != nullptr);
-        assert(ppj != nullptr);
+        MakeSmartPtr(ppi, Point, GDALUtilities::FailsafeCentroid(a));
+        MakeSmartPtr(ppj, Point, GDALUtilities::FailsafeCentroid(b));
+        assert(ppi.get() != nullptr);
+        assert(ppj.get() != nullptr);
         double dx = ppi->getX() - ppj->getX();
         double dy = ppi->getY() - ppj->getY();
         return sqrt(dx*dx + dy*dy);
 #endif
 }
 
-BridgeGraph * BridgesRPC::CreateGraph(TileCollection * tiles, double max_distance, bool verbose)
+double BridgesRPC::DistanceBetweenTiles(TileCollection *tiles, int idx1, int idx2)
 {
-    using std::cout;
-    
-    BridgeGraph *graph;
+    assert(tiles);
+
+    const TileMetrics &a = tiles->metrics(idx1);
+    const TileMetrics &b = tiles->metrics(idx2);
+    double dx = a.center.x - b.center.x;
+    double dy = a.center.y - b.center.y;
+    return sqrt(dx*dx + dy*dy);
+}
+
+size_t CentroidGrid::CellKeyHash::operator()(const CellKey &k) const
+{
+    //простое перемешивание номеров строки и столбца
+    return static_cast<size_t>(k.first * 73856093LL ^ k.second * 19349663LL);
+}
+
+CentroidGrid::CentroidGrid(double _cellSize) :
+    cellSize(_cellSize)
+{
+    assert(cellSize > 0);
+}
+
+long long CentroidGrid::cellCoord(double v) const
+{
+    return static_cast<long long>(std::floor(v / cellSize));
+}
+
+void CentroidGrid::insert(int idx, double x, double y)
+{
+    cells[CellKey(cellCoord(x), cellCoord(y))].push_back(idx);
+}
+
+void CentroidGrid::neighbours(double x, double y, std::vector<int> &result) const
+{
+    long long cx = cellCoord(x);
+    long long cy = cellCoord(y);
+
+    //просматриваем ячейку точки и 8 соседних
+    for (long long i = cx - 1;i <= cx + 1;i++)
+        for (long long j = cy - 1;j <= cy + 1;j++)
+        {
+            auto cell = cells.find(CellKey(i, j));
+            if (cell == cells.end()) continue;
+            result.insert(result.end(),
+                cell->second.begin(), cell->second.end());
+        }
+}
+
+BridgeGraph * BridgesRPC::GraphFromEdges(CandidateEdges &edges, int nvertices)
+{
+    //порядок ребер не должен зависеть от числа потоков,
+    //иначе при равных весах Краскал выбирает разные деревья
+    std::sort(edges.begin(), edges.end(),
+        [](const CandidateEdge &a, const CandidateEdge &b)
+    {
+        return (a.source != b.source) ?
+            (a.source < b.source) : (a.target < b.target);
+    });
 
     // создаем новый объект graph
-#ifdef BRIDGES_LIST
-    graph = new BridgeGraph();
-#endif
-#ifdef BRIDGES_MATR
-        //для матрицы нужно указывать явно число вершин
-    graph = new BridgeGraph(centroids->getNumGeometries());
-#endif
+    //вершины - все тайлы коллекции, число вершин задаем явно
+    BridgeGraph *graph = new BridgeGraph(nvertices);
+
+    for (auto i = edges.begin();i != edges.end();i++)
+        add_edge((*i).source, (*i).target, (*i).weight, *graph);
+
+    return graph;
+}
+
+BridgeGraph * BridgesRPC::CreateGraph(TileCollection * tiles, double max_distance, bool verbose,
+    int nthreads, const std::vector<int> *partition)
+{
+    using std::cout;
 
     assert(tiles);
+    assert(!partition || static_cast<int>(partition->size()) == tiles->size());
+
+    //при max_distance <= 0 ни одно ребро не пройдет проверку
+    //расстояния, а ячейки пространственного индекса не определены
+    if (max_distance <= 0)
+    {
+        cout << "BridgesRPC::CreateGraph: max_distance <= 0, "
+            << "graph has no edges" << std::endl;
+        return new BridgeGraph(tiles->size());
+    }
+
+    nthreads = GDALUtilities::ThreadCount(nthreads);
+
+    //характеристики тайлов считаются один раз
+    tiles->computeMetrics(nthreads);
+
+    //индексы тайлов-полигонов, их группы и опорные точки
+    std::vector<int> indices;
+    std::vector<int> groups;
+    std::vector<int> parts;
+    std::vector<OGRRawPoint> centers;
+    //пространственный индекс опорных точек
+    CentroidGrid index(max_distance);
+
+    for (int idx = 0;idx < tiles->size();idx++)
+    {
+        //не полигоны пропускаем
+        if (tiles->geometry(idx)->getGeometryType() != wkbPolygon)
+            continue;
+
+        const OGRRawPoint &c = tiles->metrics(idx).center;
+        index.insert(static_cast<int>(indices.size()), c.x, c.y);
+        indices.push_back(idx);
+        groups.push_back(tiles->group(idx));
+        parts.push_back(partition ? (*partition)[idx] : 0);
+        centers.push_back(c);
+    }
+
+    int n = static_cast<int>(indices.size());
 
     //данные прогресса
     GDALUtilities::ProgressIndicator
-        indicator(tiles->size()*tiles->size() / 2,
-            "BridgesRPC::CreateGraph");
-
-    /*перебираем все исходные геометрии
-    считаем расстояние между ними
-    добавляем ребра*/
-    for (auto i = tiles->begin();i != tiles->end();i++)
-    {
-        //j указывает на следующий элемент
-        auto j = i;
-        j++;
-        for (;j != tiles->end();j++)
+        indicator(n, "BridgesRPC::CreateGraph");
+
+    //ребра из буферов всех потоков
+    CandidateEdges edges;
+
+    /*перебираем тайлы
+    для каждого берем соседей из пространственного индекса,
+    считаем расстояние между ними, добавляем ребра
+    в буфер своего потока*/
+#pragma omp parallel num_threads(nthreads)
+    {
+        CandidateEdges local;
+        std::vector<int> candidates;
+
+#pragma omp for schedule(dynamic, 256) nowait
+        for (int i = 0;i < n;i++)
         {
             //обновляем прогрессбар
             if (verbose)
+            {
+#pragma omp critical(CreateGraphProgress)
                 indicator.incOperationCount();
+            }
 
-            //тайлы
-            auto ti = (*i).second;
-            auto tj = (*j).second;
-
-            assert(ti);
-            assert(tj);
-
-            auto pi = dynamic_cast<OGRPolygon*>
-                (ti->geometry());
-            auto pj = dynamic_cast<OGRPolygon*>
-                (tj->geometry());
-
-            //если не удалось преобразование типов,
-            //пропускаем цикл
-            if (!pi || !pj) continue;
-
-            //расстояние между полигонами
-            double distBetween =
-                DistanceBetweenPolygons(pi, pj);
-
-            //ошибки вычисления расстояния не должно быть!
-            //distBetween = -1, если произошла ошибка GEOS
-            assert(distBetween > 0);
+            candidates.clear();
+            index.neighbours(centers[i].x, centers[i].y, candidates);
 
-            //проверяем расстояние
-            if (distBetween <= max_distance)
-                //оно меньше заданного
+            for (auto j : candidates)
             {
+                //каждую пару рассматриваем один раз
+                if (j <= i) continue;
+
                 //проверяем группы
                 //они не должны совпадать
-                if (tiles->inSameGroup(ti->index(), tj->index()))
+                if (groups[i] == groups[j])
+                    continue;
+                //и тайлы должны быть из одной части
+                if (parts[i] != parts[j])
                     continue;
+
+                //расстояние между опорными точками,
+                //таблица характеристик уже рассчитана
+                double distBetween =
+                    DistanceBetweenTiles(tiles, indices[i], indices[j]);
+
+                //проверяем расстояние
+                if (distBetween > max_distance) continue;
+
                 //полигоны из разных групп
                 //можно создавать мостики.
-                //создаем ребро
-                add_edge(ti->index(), tj->index(), 
-                    distBetween, *graph);
+                CandidateEdge e = { indices[i], indices[j], distBetween };
+                local.push_back(e);
             }
+        }
 
-            if (verbose)
+        //сливаем буфер потока в общий массив
+#pragma omp critical(CreateGraphMerge)
+        edges.insert(edges.end(), local.begin(), local.end());
+    }
+
+    //создаем граф
+    BridgeGraph *graph = GraphFromEdges(edges, tiles->size());
+
+    if (verbose)
+    {
+        //печатаем пользователю информацию о созданном графе
+        cout << "\nBridgesRPC::CreateGraph info: " << std::endl;
+        cout << "\tnumber of edges: " << num_edges(*graph) << std::endl;
+        cout << "\tnumber of vertices: " << num_vertices(*graph) << std::endl;
+    }
+
+    return graph;
+}
+
+BridgeGraph * BridgesRPC::CreateDelaunayGraph(TileCollection * tiles, bool verbose, int nthreads)
+{
+    using std::cout;
+
+    assert(tiles);
+
+    //характеристики тайлов считаются один раз
+    tiles->computeMetrics(nthreads);
+
+    //тайлы, сгруппированные по опорным точкам
+    //у нескольких тайлов точка может совпадать
+    typedef std::pair<double, double> PointKey;
+    std::map< PointKey, std::vector<int> > tilesByPoint;
+    //вершины триангуляции - различные опорные точки
+    TempOMPT points(newMultiPoint(), destroy);
+
+    for (int idx = 0;idx < tiles->size();idx++)
+    {
+        //не полигоны пропускаем
+        if (tiles->geometry(idx)->getGeometryType() != wkbPolygon)
+            continue;
+
+        const OGRRawPoint &c = tiles->metrics(idx).center;
+        auto &sameTiles = tilesByPoint[PointKey(c.x, c.y)];
+        if (sameTiles.empty())
+            points->addGeometryDirectly(new OGRPoint(c.x, c.y));
+        sameTiles.push_back(idx);
+    }
+
+    CandidateEdges edges;
+
+    //добавление ребер между всеми тайлами двух точек,
+    //кроме тайлов одной группы
+    auto connect = [&](const std::vector<int> &a,
+        const std::vector<int> &b, double weight)
+    {
+        for (auto i : a)
+            for (auto j : b)
             {
-                //печатаем пользователю информацию о созданном графе
-                cout << "\nBridgesRPC::CreateGraph info: " << std::endl;
-                cout << "\tnumber of edges: " << num_edges(*graph) << std::endl;
-                cout << "\tnumber of vertices: " << num_vertices(*graph) << std::endl;
+                if (i == j || tiles->inSameGroup(i, j))
+                    continue;
+                CandidateEdge e = { std::min(i, j), std::max(i, j), weight };
+                edges.push_back(e);
             }
+    };
+
+    //тайлы с совпадающими точками соединяем друг с другом
+    for (auto i = tilesByPoint.begin();i != tilesByPoint.end();i++)
+    {
+        const std::vector<int> &same = (*i).second;
+        for (size_t k = 1;k < same.size();k++)
+            connect(std::vector<int>(same.begin(), same.begin() + k),
+                std::vector<int>(1, same[k]), 0.0);
+    }
+
+    if (points->getNumGeometries() < 3)
+    {
+        //триангуляцию строить не из чего, соединяем точки напрямую
+        for (auto i = tilesByPoint.begin();i != tilesByPoint.end();i++)
+            for (auto j = std::next(i);j != tilesByPoint.end();j++)
+                connect((*i).second, (*j).second, DistanceBetweenTiles(
+                    tiles, (*i).second.front(), (*j).second.front()));
+    }
+    else
+    {
+        //триангуляция Делоне, только ребра
+        MakeSmartPtr(triangulation, GeometryCollection,
+            points->DelaunayTriangulation(0.0, TRUE));
+        if (!triangulation.get())
+        {
+            cout << "BridgesRPC::CreateDelaunayGraph: "
+                << "Delaunay triangulation failed" << std::endl;
+            return nullptr;
+        }
+
+        for (int i = 0;i < triangulation->getNumGeometries();i++)
+        {
+            auto ls = dynamic_cast<OGRLineString*>
+                (triangulation->getGeometryRef(i));
+            if (!ls || ls->getNumPoints() < 2) continue;
+
+            //GEOS возвращает исходные координаты вершин,
+            //поэтому тайлы находятся по точному совпадению
+            auto a = tilesByPoint.find(PointKey(ls->getX(0), ls->getY(0)));
+            auto b = tilesByPoint.find(PointKey(ls->getX(1), ls->getY(1)));
+            if (a == tilesByPoint.end() || b == tilesByPoint.end())
+                continue;
+
+            //у всех тайлов точки одна и та же опорная точка
+            connect((*a).second, (*b).second, DistanceBetweenTiles(
+                tiles, (*a).second.front(), (*b).second.front()));
         }
     }
 
-                return graph;
+    //создаем граф
+    BridgeGraph *graph = GraphFromEdges(edges, tiles->size());
+
+    if (verbose)
+    {
+        //печатаем пользователю информацию о созданном графе
+        cout << "\nBridgesRPC::CreateDelaunayGraph info: " << std::endl;
+        cout << "\tnumber of edges: " << num_edges(*graph) << std::endl;
+        cout << "\tnumber of vertices: " << num_vertices(*graph) << std::endl;
+    }
+
+    return graph;
 }
 
 MinimumSpanningTree *BridgesRPC::KruskalMST(BridgeGraph *g, bool verbose)
@@ -299,45 +501,45 @@ OGRPolygon * BridgesRPC::BridgeWithBufferedLine(OGRPolygon * p1, OGRPolygon * p2
     assert(p1 != nullptr);
     assert(p2 != nullptr);
 
+    return BridgeWithBufferedLine(Tiles::ComputeTileMetrics(p1),
+        Tiles::ComputeTileMetrics(p2));
+}
+
+OGRPolygon * BridgesRPC::BridgeWithBufferedLine(const TileMetrics &m1, const TileMetrics &m2,
+    int arcSegments)
+{
     //считаем размер буферной зоны
     double buf_sz =
-        std::min(GDALUtilities::InscribedCircleRadius(p1),
-            GDALUtilities::InscribedCircleRadius(p2));
+        std::min(m1.inscribedRadius, m2.inscribedRadius);
 
     //не смогли вычислить размер буферной зоны, ничего не возвращаем
-     if (fabs(buf_sz) < 1e-6)
-         return nullptr;
+    if (buf_sz < 1e-6)
+        return nullptr;
 
-    //считаем центроиды полигонов
-    std::shared_ptr<OGRPoint>
-        c1( GDALUtilities::FailsafeCentroid(p1),
-            OGRGeometryFactory::destroyGeometry);
-    std::shared_ptr<OGRPoint>
-        c2(GDALUtilities::FailsafeCentroid(p2),
-            OGRGeometryFactory::destroyGeometry);
-
-    //не должна происходить ошибка приведения типов!
-    assert(c1.get() != nullptr);
-    assert(c2.get() != nullptr);
-
-    //создаем отрезок
-    std::shared_ptr<OGRLineString>
-        ls(dynamic_cast<OGRLineString*>
-            (OGRGeometryFactory::createGeometry(wkbLineString)),
-            OGRGeometryFactory::destroyGeometry);
-    //добавляем в него две точки
-    ls->addPoint(c1.get());
-    ls->addPoint(c2.get());
-
-    //буферизуем его
-    OGRPolygon *res =
-        dynamic_cast<OGRPolygon*>
-        (ls->Buffer(buf_sz));
-    //не должно быть ошибок приведения типа
-    assert(res != nullptr);
+    //буферизованный отрезок между опорными точками - капсула,
+    //ее контур строим сразу, без GEOS Buffer
+    return GDALUtilities::CreateCapsule(m1.center, m2.center,
+        buf_sz, arcSegments);
+}
 
-    //возвращаем новый полигон
-    return res;
+double BridgesRPC::EstimateBridgeArea(const TileMetrics &m1, const TileMetrics &m2,
+    int arcSegments)
+{
+    //ширина буфера - так же, как в BridgeWithBufferedLine
+    double r = std::min(m1.inscribedRadius, m2.inscribedRadius);
+    if (r < 1e-6)
+        return -1;
+
+    //длина отрезка
+    double dx = m1.center.x - m2.center.x;
+    double dy = m1.center.y - m2.center.y;
+    double len = sqrt(dx*dx + dy*dy);
+
+    //прямоугольник и два полукруга на концах, полукруги
+    //вместе - правильный многоугольник из 2*arcSegments сторон
+    const double pi = 3.14159265358979323846;
+    int n = 2 * arcSegments;
+    return 2 * r * len + 0.5 * n * r * r * sin(2 * pi / n);
 }
 
 OGRPolygon * BridgesRPC::AutoBridge(OGRPolygon *p1,OGRPolygon *p2, size_t *counter_ch,
@@ -362,22 +564,86 @@ OGRPolygon * BridgesRPC::AutoBridge(OGRPolygon *p1,OGRPolygon *p2, size_t *count
     
     //BridgeWithConvexHull - пока не используется
 
-    res = BridgeWithBufferedLine(p1, p2);
+    res = BridgeWithBufferedLine(p[0], p[1]);
     if (counter_br)
-        *counter_br++;
+        (*counter_br)++;
 
     return res;
 }
 
-OGC *BridgesRPC::CreateBridgesByTree
-(MinimumSpanningTree *tree,TileCollection *tiles)
+OGRPolygon * BridgesRPC::AutoBridge(TileCollection *tiles, int idx1, int idx2,
+    size_t *counter_ch, size_t *counter_br)
+{
+    assert(tiles);
+
+    const TileMetrics *m1 = &tiles->metrics(idx1);
+    const TileMetrics *m2 = &tiles->metrics(idx2);
+    //m1 - меньший тайл, m2 - больший
+    if (m2->area < m1->area)
+        std::swap(m1, m2);
+
+    //BridgeWithConvexHull - пока не используется
+
+    OGRPolygon *res = BridgeWithBufferedLine(*m1, *m2);
+    if (counter_br)
+        (*counter_br)++;
+
+    return res;
+}
+
+BridgeList *BridgesRPC::BuildBridges
+(MinimumSpanningTree *tree, TileCollection *tiles, int nthreads)
 {
-    //данные прогресса
     assert(tree);
+    assert(tiles);
+
+    nthreads = GDALUtilities::ThreadCount(nthreads);
+
+    //характеристики считаем заранее, в параллельном
+    //участке таблица характеристик только читается
+    tiles->computeMetrics(nthreads);
+
+    //данные прогресса
+    int nedges = static_cast<int>(tree->size());
     GDALUtilities::ProgressIndicator
-        indicator(tree->size(), "BridgesRPC::CreateBridgesByTree");
+        indicator(nedges, "BridgesRPC::BuildBridges");
+
+    //мостик i-го ребра записывается в i-й элемент,
+    //поэтому результат не зависит от числа потоков
+    BridgeList *bridges = new BridgeList(nedges, nullptr);
+
+    //каждый вызов GEOS через OGR создает свой контекст GEOS,
+    //поэтому мостики можно строить в разных потоках
+#pragma omp parallel for schedule(dynamic, 16) num_threads(nthreads)
+    for (int i = 0;i < nedges;i++)
+    {
+#pragma omp critical(BuildBridgesProgress)
+        indicator.incOperationCount();
 
+        //текущее ребро
+        const Edge &e = (*tree)[i];
+        int m_source = static_cast<int>(e.m_source);
+        int m_target = static_cast<int>(e.m_target);
+
+        //мостики строятся только между полигонами
+        if (tiles->geometry(m_source)->getGeometryType() != wkbPolygon ||
+            tiles->geometry(m_target)->getGeometryType() != wkbPolygon)
+            continue;
+
+        (*bridges)[i] = AutoBridge(tiles, m_source, m_target);
+    }
+
+    return bridges;
+}
+
+OGC *BridgesRPC::CreateBridgesByTree
+(MinimumSpanningTree *tree,TileCollection *tiles, int nthreads)
+{
+    assert(tree);
     assert(tiles);
+
+    //строим мостики параллельно
+    std::shared_ptr<BridgeList> built(BuildBridges(tree, tiles, nthreads));
     
     /*создаем новую коллекцию полигонов
     Почему не OGRMultiPolygon? Ведь в коллекции только полигоны.
@@ -389,49 +655,37 @@ OGC *BridgesRPC::CreateBridgesByTree
     //из OGRGeometry в OGRGeometryFactory
     assert(bridges != nullptr);
 
-    //перебираем дерево, создаем мостики
-    for (auto i = tree->begin();i != tree->end();i++)
+    //перебираем дерево, собираем мостики в порядке ребер
+    for (size_t i = 0;i < tree->size();i++)
     {
-#ifndef BRIDGES_DEBUG
-        //обновляем прогрессбар
-        indicator.incOperationCount();
-#endif
         //текущее ребро
-        Edge e = *i;
+        Edge e = (*tree)[i];
         //не должно быть переполнения переменных индекса
         int m_source = static_cast<int>(e.m_source);
         int m_target = static_cast<int>(e.m_target);
         assert(m_source == e.m_source);
         assert(m_target == e.m_target);
 
-        //соответствующие тайлы
-        auto srcTile = tiles->tileByIndex(m_source);
-        auto destTile = tiles->tileByIndex(m_target);
-        //берем геометрии из коллекции
-        OGRGeometry *src = srcTile->geometry();
-        OGRGeometry *dst = destTile->geometry();
+        //берем геометрии соответствующих тайлов из коллекции
+        OGRGeometry *src = tiles->geometry(m_source);
+        OGRGeometry *dst = tiles->geometry(m_target);
         //они не должны быть nullptr
         assert(src);
         assert(dst);
         //проверяем, что это полигоны
         if (src->getGeometryType() != wkbPolygon ||
             dst->getGeometryType() != wkbPolygon) continue;
-        //преобразуем геометрии
-        OGRPolygon *p_src = static_cast<OGRPolygon*>
-            (src);
-        OGRPolygon *p_dst = static_cast<OGRPolygon*>
-            (dst);
-        //создаем геометрию нового мостика
-        OGRPolygon *bridge = AutoBridge(p_src,p_dst);
+        //геометрия нового мостика
+        OGRPolygon *bridge = (*built)[i];
         //может возникнуть ошибка при создании мостика
         if (bridge)
         {
 #ifdef BRIDGES_DEBUG
             std::cout << "BRIDGE: Polygon";
-            std::cout << srcTile->index() << " from group ";
-            std::cout << srcTile->group();
-            std::cout << " and Polygon" << destTile->index();
-            std::cout << " from group " << destTile->group();
+            std::cout << m_source << " from group ";
+            std::cout << tiles->group(m_source);
+            std::cout << " and Polygon" << m_target;
+            std::cout << " from group " << tiles->group(m_target);
             std::cout << std::endl;
 #endif
             //геометрия должна быть валидна
@@ -468,28 +722,244 @@ OGC *BridgesRPC::CreateBridgesByTree
     return bridges;
 }
 
+GroupConnectivityStruct *BridgesRPC::GenerateConnectivity(
+    MinimumSpanningTree *tree, TileCollection *tiles, int nthreads)
+{
+    assert(tree);
+    assert(tiles);
 
-TileCollection *BridgesRPC::SplitGeometryByGrid
-(OGRGeometryCollection *input, OGRGeometryCollection *grid, bool verbose)
+    //лучшее ребро для каждой пары групп:
+    //<оценка площади мостика, номер ребра в дереве>
+    typedef std::pair<double, size_t> Candidate;
+    std::map< SortedPair, Candidate > best;
+
+    //перебираем дерево, оцениваем площади мостиков
+    for (size_t i = 0;i < tree->size();i++)
+    {
+        //текущее ребро
+        Edge e = (*tree)[i];
+        //не должно быть переполнения переменных индекса
+        int m_source = static_cast<int>(e.m_source);
+        int m_target = static_cast<int>(e.m_target);
+        assert(m_source == e.m_source);
+        assert(m_target == e.m_target);
+
+        //берем геометрии соответствующих тайлов из коллекции
+        OGRGeometry *src = tiles->geometry(m_source);
+        OGRGeometry *dst = tiles->geometry(m_target);
+        //они не должны быть nullptr
+        assert(src);
+        assert(dst);
+        //проверяем, что это полигоны
+        if (src->getGeometryType() != wkbPolygon ||
+            dst->getGeometryType() != wkbPolygon) continue;
+
+        //оценка площади по опорным точкам и радиусам тайлов
+        double area = EstimateBridgeArea(
+            tiles->metrics(m_source), tiles->metrics(m_target));
+        //мостик по этому ребру построить не получится
+        if (area < 0)
+        {
+            std::cout << "Error when creating bridge"
+                << std::endl;
+            continue;
+        }
+
+        //пара групп, которую соединяет ребро
+        SortedPair p(tiles->group(m_source), tiles->group(m_target));
+
+        //запоминаем ребро, если оно лучше найденного ранее
+        auto found = best.find(p);
+        if (found == best.end())
+            best.insert(std::make_pair(p, Candidate(area, i)));
+        else if (area < (*found).second.first)
+            (*found).second = Candidate(area, i);
+    }
+
+    //ребра-победители в порядке пар групп
+    MinimumSpanningTree winners;
+    for (auto i = best.begin();i != best.end();i++)
+        winners.push_back((*tree)[(*i).second.second]);
+
+    //строим геометрию только для победителей
+    std::shared_ptr<BridgeList> built(
+        BuildBridges(&winners, tiles, nthreads));
+
+    //выходная структура данных
+    auto conn =
+        new GroupConnectivityStruct;
+
+    size_t k = 0;
+    for (auto i = best.begin();i != best.end();i++, k++)
+    {
+        //геометрия нового мостика
+        OGRPolygon *bridge = (*built)[k];
+        //может возникнуть ошибка при создании мостика
+        if (!bridge)
+        {
+            //не удалось создать мостик
+            //говорим об этом пользователю
+            std::cout << "Error when creating bridge"
+                << std::endl;
+            continue;
+        }
+
+        //геометрия должна быть валидна
+        assert(bridge->IsValid());
+
+        //создаем коллекцию геометрий с мостиком пары групп
+        TempOGC gc(newGeometryCollection(), destroy);
+        gc->addGeometryDirectly(bridge);
+        conn->insert(std::make_pair((*i).first, gc));
+    }
+
+    //Возвращаем структуру данных
+    return conn;
+}
+
+//тайлы одного исходного полигона
+typedef std::vector<OGRGeometry*> TileBuffer;
+
+//пересечение полигона с элементом сетки складываем в буфер
+//тайлов, если элемент сетки пересекает внешний контур полигона
+//Если задан rect - bounding box прямоугольного элемента сетки,
+//полигон отсекается по координатам без GEOS
+static void AddCellTiles(TileBuffer &tiles, OGRGeometry *curInput,
+    const GDALUtilities::PreparedGeometry &contour, OGRGeometry *curGrid,
+    const OGREnvelope *rect = nullptr)
 {
-    assert(grid);
-    assert(input);
+    //элемент сетки должен пересекать внешнее кольцо полигона!
+    if (!contour.intersects(curGrid)) return;
+
+    //геомертрия пересечения
+    auto newGeom = rect ?
+        GDALUtilities::ClipPolygonByRectangle(static_cast<OGRPolygon*>(curInput), *rect) :
+        curInput->Intersection(curGrid);
+    //пересечение только по границе
+    if (!newGeom) return;
+    //проверяем вид этой геометрии
+    auto gtype = newGeom->getGeometryType();
+    switch (gtype)
+    {
+    case wkbPolygon:
+    {
+#ifdef BRIDGES_DEBUG
+        //debug вывод в консоль
+        ExamineGeometry(newGeom);
+#endif
+        //создаем новый тайл
+        tiles.push_back(newGeom);
+        break;
+    }
+    case wkbMultiPolygon:
+    {
+        auto newGeomP = dynamic_cast<OMP*>(newGeom);
+        //из мультиполигона берем полигоны и записываем в коллекцию
+        assert(newGeomP);
+        //полигоны забираем из мультиполигона по одному,
+        //владельцем становится буфер тайлов
+        while (newGeomP->getNumGeometries() > 0)
+        {
+            //полигон из получившегося мультиполигона
+            OGRGeometry *z = newGeomP->getGeometryRef(0);
+            assert(z);
+            newGeomP->removeGeometry(0, FALSE);
+            //создаем новый тайл
+            tiles.push_back(z);
+        }
+        //пустой мультиполигон больше не нужен
+        destroy(newGeom);
+        break;
+    }
+    case wkbLineString:
+    {
+        //такое возможно, если элемент сетки касается
+        //нашей геометрии
+        //это не ошибка, но линию в выходную коллекцию
+        //добавлять не будем.
+#ifdef BRIDGES_DEBUG
+        //debug вывод в консоль
+        ExamineGeometry(newGeom);
+#endif
+        destroy(newGeom);
+        break;
+    }
+    default:
+        //такого не должно быть!
+        assert(0);
+        destroy(newGeom);
+        break;
+    }
+}
 
-    //в operated складываем тайлы
-    auto tiles = new TileCollection;
+//деление полигона на тайлы, пересекающие его внешний контур.
+//Параметры: полигон, подготовленный контур, bounding box полигона,
+//буфер для тайлов
+typedef std::function<void(OGRGeometry*,
+    const GDALUtilities::PreparedGeometry&, const OGREnvelope&,
+    TileBuffer&)> PolygonSplitter;
 
-    //данные прогресса
-    GDALUtilities::ProgressIndicator
-        indicator(input->getNumGeometries()*grid->getNumGeometries(), 
-            "BridgesRPC::splitInputByGrid");
+//число вершин во всех контурах полигона
+static int PolygonVertexCount(OGRPolygon *p)
+{
+    int n = 0;
+    if (p->getExteriorRing())
+        n += p->getExteriorRing()->getNumPoints();
+    for (int i = 0;i < p->getNumInteriorRings();i++)
+        n += p->getInteriorRing(i)->getNumPoints();
+    return n;
+}
+
+//параллельное деление исходных полигонов. Полигоны независимы,
+//самые большие (по числу вершин) раздаются потокам первыми,
+//тайлы каждого полигона копятся в своем буфере и добавляются
+//в коллекцию в порядке полигонов, поэтому индексы тайлов
+//не зависят от числа потоков
+static TileCollection *SplitPolygons(OGRGeometryCollection *input,
+    bool verbose, int nthreads, const PolygonSplitter &split)
+{
+    assert(input);
 
     int ngeom = input->getNumGeometries();
     //нечего разделять, ничего не возвращаем
     if (ngeom == 0) return nullptr;
 
-    //перебираем исходные полигоны
-    for (int i = 0;i < input->getNumGeometries();i++)
+    //порядок обработки - по убыванию числа вершин
+    std::vector<int> order(ngeom);
+    std::vector<int> cost(ngeom, 0);
+    for (int i = 0;i < ngeom;i++)
+    {
+        order[i] = i;
+        auto g = input->getGeometryRef(i);
+        if (g->getGeometryType() == wkbPolygon)
+            cost[i] = PolygonVertexCount(static_cast<OGRPolygon*>(g));
+    }
+    std::stable_sort(order.begin(), order.end(),
+        [&cost](int a, int b) { return cost[a] > cost[b]; });
+
+    //данные прогресса
+    GDALUtilities::ProgressIndicator
+        indicator(ngeom, "BridgesRPC::splitInputByGrid");
+
+    //тайлы каждого исходного полигона
+    std::vector<TileBuffer> buffers(ngeom);
+
+    //каждый вызов GEOS через OGR создает свой контекст GEOS,
+    //поэтому полигоны можно делить в разных потоках
+#pragma omp parallel for schedule(dynamic, 1) \
+    num_threads(GDALUtilities::ThreadCount(nthreads))
+    for (int k = 0;k < ngeom;k++)
     {
+        int i = order[k];
+#ifndef BRIDGES_DEBUG
+        //прогресс
+        //не работает в debug'e
+        if (verbose)
+        {
+#pragma omp critical(SplitPolygonsProgress)
+            indicator.incOperationCount();
+        }
+#endif
         //текущий полигон суши
         auto curInput = input->getGeometryRef(i);
 
@@ -504,75 +974,151 @@ TileCollection *BridgesRPC::SplitGeometryByGrid
                     static_cast<OGRPolygon*>(curInput)
                     ),
                 destroy);
+        if (!mls) continue;
+        //контур проверяется на пересечение со многими
+        //элементами сетки, поэтому подготавливаем его
+        GDALUtilities::PreparedGeometry contour(mls.get());
+
+        OGREnvelope env;
+        curInput->getEnvelope(&env);
+
+        split(curInput, contour, env, buffers[i]);
+    }
 
+    //собираем тайлы в коллекцию, группа - номер исходного полигона
+    auto tiles = new TileCollection;
+    for (int i = 0;i < ngeom;i++)
+        for (auto t = buffers[i].begin();t != buffers[i].end();t++)
+            tiles->addTile(*t, i);
+
+    return tiles;
+}
+
+TileCollection *BridgesRPC::SplitGeometryByGrid
+(OGRGeometryCollection *input, OGRGeometryCollection *grid, bool verbose,
+    int nthreads)
+{
+    assert(grid);
+    assert(input);
+
+    //bounding box элементов сетки считаем один раз
+    int ngrid = grid->getNumGeometries();
+    std::vector<OGREnvelope> gridEnvelopes(ngrid);
+    for (int j = 0;j < ngrid;j++)
+        grid->getGeometryRef(j)->getEnvelope(&gridEnvelopes[j]);
+
+    return SplitPolygons(input, verbose, nthreads,
+        [&](OGRGeometry *curInput,
+            const GDALUtilities::PreparedGeometry &contour,
+            const OGREnvelope &env, TileBuffer &out)
+    {
         //смотрим, с какими элементами сетки пересекается полигон
-        for (int j = 0;j < grid->getNumGeometries();j++)
+        for (int j = 0;j < ngrid;j++)
         {
-#ifndef BRIDGES_DEBUG
-            //прогресс
-            //не работает в debug'e
-            if (verbose)
-                indicator.incOperationCount();
-#endif
-            //текущий квадратик сетки
-            auto curGrid = grid->getGeometryRef(j);
+            //сначала дешевая проверка по bounding box
+            if (!gridEnvelopes[j].Intersects(env))
+                continue;
+            AddCellTiles(out, curInput, contour, grid->getGeometryRef(j));
+        }
+    });
+}
 
-            //элемент сетки должен пересекать внешнее кольцо полигона!
-            if (!curGrid->Intersects(mls.get())) continue;
+//тайлы вместе с номером ячейки сетки, из которой они получены
+typedef std::vector<std::pair<long long, OGRGeometry*> > CellTileBuffer;
 
-            //геомертрия пересечения
-            auto newGeom = curInput->Intersection(curGrid);
-            //проверяем вид этой геометрии
-            auto gtype = newGeom->getGeometryType();
-            switch (gtype)
-            {
-            case wkbPolygon:
-            {
-#ifdef BRIDGES_DEBUG
-                //debug вывод в консоль
-                ExamineGeometry(newGeom);
-#endif
-                //создаем новый тайл
-                tiles->addTile(new Tile(newGeom,i));
-                break;
-            }
-            case wkbMultiPolygon:
-            {
-                auto newGeomP = dynamic_cast<OMP*>(newGeom);
-                //из мультиполигона берем полигоны и записываем в коллекцию
-                assert(newGeomP);
-                for (int k = 0;k < newGeomP->getNumGeometries();k++)
-                {
-                    //полигон из получившегося мультиполигона
-                    OGRGeometry *z = newGeomP->getGeometryRef(k);
-                    assert(z);
-                    //создаем новый тайл
-                    tiles->addTile(new Tile(z, i));
-                }
-                break;
-            }
-            case wkbLineString:
+//деление куска полигона ячейками из диапазона range. Пока в куске
+//больше vertexBudget вершин, он делится на квадранты по линиям
+//сетки, и ячейки отсекаются от меньших кусков
+static void SplitFragment(CellTileBuffer &out, OGRPolygon *fragment,
+    const GDALUtilities::PreparedGeometry &contour,
+    const GDALUtilities::RegularGrid &grid,
+    GDALUtilities::RegularGrid::CellRange range, int vertexBudget)
+{
+    typedef GDALUtilities::RegularGrid::CellRange CellRange;
+
+    //оставляем только ячейки под bounding box куска
+    OGREnvelope env;
+    fragment->getEnvelope(&env);
+    CellRange touching = grid.cellsTouching(env);
+    range.firstRow = std::max(range.firstRow, touching.firstRow);
+    range.lastRow = std::min(range.lastRow, touching.lastRow);
+    range.firstCol = std::max(range.firstCol, touching.firstCol);
+    range.lastCol = std::min(range.lastCol, touching.lastCol);
+    if (range.empty()) return;
+
+    bool singleCell = range.firstRow == range.lastRow &&
+        range.firstCol == range.lastCol;
+    if (vertexBudget <= 0 || singleCell ||
+        PolygonVertexCount(fragment) <= vertexBudget)
+    {
+        for (int row = range.firstRow;row <= range.lastRow;row++)
+            for (int col = range.firstCol;col <= range.lastCol;col++)
             {
-                //такое возможно, если элемент сетки касается
-                //нашей геометрии
-                //это не ошибка, но линию в выходную коллекцию
-                //добавлять не будем.
-#ifdef BRIDGES_DEBUG
-                //debug вывод в консоль
-                ExamineGeometry(newGeom);
-#endif
-                break;
-            }
-            default:
-                //такого не должно быть!
-                assert(0);
-                break;
+                shared_ptr<OGRPolygon> curGrid(grid.cell(row, col), destroy);
+                //ячейка - прямоугольник, отсекаем кусок по ее границам
+                OGREnvelope cellEnv = grid.cellEnvelope(row, col);
+                TileBuffer cellTiles;
+                AddCellTiles(cellTiles, fragment, contour, curGrid.get(), &cellEnv);
+                long long cellIndex = static_cast<long long>(row)*grid.cols() + col;
+                for (auto t = cellTiles.begin();t != cellTiles.end();t++)
+                    out.push_back(std::make_pair(cellIndex, *t));
             }
+        return;
+    }
 
+    //делим диапазон пополам по строкам и по столбцам
+    int midRow = (range.firstRow + range.lastRow) / 2;
+    int midCol = (range.firstCol + range.lastCol) / 2;
+    const CellRange quadrants[4] = {
+        { range.firstRow, midRow, range.firstCol, midCol },
+        { range.firstRow, midRow, midCol + 1, range.lastCol },
+        { midRow + 1, range.lastRow, range.firstCol, midCol },
+        { midRow + 1, range.lastRow, midCol + 1, range.lastCol } };
+    for (int q = 0;q < 4;q++)
+    {
+        if (quadrants[q].empty()) continue;
+        shared_ptr<OGRGeometry> piece(
+            GDALUtilities::ClipPolygonByRectangle(fragment,
+                grid.rangeEnvelope(quadrants[q])),
+            destroy);
+        if (!piece) continue;
+        if (piece->getGeometryType() == wkbPolygon)
+        {
+            SplitFragment(out, static_cast<OGRPolygon*>(piece.get()),
+                contour, grid, quadrants[q], vertexBudget);
+            continue;
         }
+        auto parts = static_cast<OMP*>(piece.get());
+        for (int k = 0;k < parts->getNumGeometries();k++)
+            SplitFragment(out, static_cast<OGRPolygon*>(parts->getGeometryRef(k)),
+                contour, grid, quadrants[q], vertexBudget);
     }
+}
 
-    return tiles;
+TileCollection *BridgesRPC::SplitGeometryByGrid
+(OGRGeometryCollection *input, const GDALUtilities::RegularGrid &grid, bool verbose,
+    int nthreads, int vertexBudget)
+{
+    assert(input);
+
+    return SplitPolygons(input, verbose, nthreads,
+        [&](OGRGeometry *curInput,
+            const GDALUtilities::PreparedGeometry &contour,
+            const OGREnvelope &env, TileBuffer &out)
+    {
+        //перебираем только ячейки, которые касаются bounding box
+        //полигона, их номера считаются без перебора сетки
+        CellTileBuffer cellTiles;
+        SplitFragment(cellTiles, static_cast<OGRPolygon*>(curInput),
+            contour, grid, grid.cellsTouching(env), vertexBudget);
+        //тайлы в порядке ячеек, как без деления на квадранты
+        std::stable_sort(cellTiles.begin(), cellTiles.end(),
+            [](const std::pair<long long, OGRGeometry*> &a,
+                const std::pair<long long, OGRGeometry*> &b)
+            { return a.first < b.first; });
+        for (auto t = cellTiles.begin();t != cellTiles.end();t++)
+            out.push_back(t->second);
+    });
 }
 
 BridgesRPC::BridgeConstructor::BridgeConstructor(OGRGeometryCollection *_input, double _ratio, double _max_distance)
@@ -630,127 +1176,47 @@ OGC *BridgeConstructor::exec()
 
     shared_ptr<TileCollection> tiles;
 
-    //проверяем, есть ли кэш
-    //если мы уже поделили геометрию сеткой, не будем делать это еще раз
-#ifdef BRIDGES_CACHING
-    if (!FileExists("G:/testmap/test_results/tiles.shp"))
+    //ключ кэша - исходная геометрия и шаг сетки
+    Tiles::TileCacheKey key;
+    if (!cacheFile.empty())
     {
-#endif
-        //генерируем сетку, которая покрывает полигоны
-        TempOGC grid(GDALUtilities::GenerateGrid(input, avg_len), destroy);
-
-        //делим полигоны сеткой
-        //TempOGC operated(splitGeometryByGrid(input, grid.get()), dg);
-
-        tiles.reset( SplitGeometryByGrid(input, grid.get()) );
-
-#ifdef BRIDGES_CACHING
-        //сохраняем массив в кэш
-        std::ofstream f("G:/testmap/test_results/bm.txt", std::ios::binary);
-        boost::archive::text_oarchive oarch(f);
-        oarch << bm;
-        f.close();
-#endif
-
-        ///\todo сделать сохранение в файл
-        //сохраняем в файл
-        //if (tiles.get())
-        //    SaveTmp("G:/testmap/test_results/tiles.shp", tiles.get());
-#ifdef BRIDGES_CACHING
-    }
-    else
-    {
-        //уже поделили сеткой, считываем поделенную геометрию
-        GDALUtilities::StringList list;
-        list.push_back("G:/testmap/test_results/tiles.shp");
-        TempOMP res(GDALUtilities::FetchGeometryFromFiles(list, "tiles"), 
-            destroy);
-
-        //считываем структуру с флагами
-        std::ifstream f("G:/testmap/test_results/bm.txt", std::ios::binary);
-        boost::archive::text_iarchive iarch(f);
-        iarch >> bm;
-        f.close();
-        
-        for (int i = 0;i < res->getNumGeometries();i++)
-            tiles->addGeometry(res->getGeometryRef(i));
+        std::vector<unsigned char> wkb(input->WkbSize());
+        input->exportToWkb(wkbNDR, wkb.data());
+        key.addBytes(wkb.data(), wkb.size());
+        key.addDouble(avg_len);
+        //если мы уже поделили геометрию сеткой, не будем делать это еще раз
+        tiles.reset(Tiles::LoadTileCache(cacheFile, key.value(), avg_len));
     }
-#endif
-/*
-    int cnt = 1;
 
-    //кластеризуем полигоны
-    int nclasters = 10;
-    std::shared_ptr<ClasterUtils::GeometryClasters> clasters(
-        ClasterUtils::ClasterizeByCentroids(tiles.get(),nclasters));
-
-    OGC *final_bridges = newGeometryCollection();
-
-    //строим мостики в каждом кластере
-    cnt = 1;
-    for (auto i = clasters->begin();i != clasters->end();i++)
+    if (!tiles)
     {
-        //сохраняем тайлы, сгрупированные по кластерам
-            std::string fname = std::string("G:/testmap/test_results/tiles")
-                + std::to_string(cnt)
-                + std::string(".shp");
-            SaveTmp(fname, *i);
-
-        //считаем центроиды
-        TempOMPT centroids(GDALUtilities::CalculateCentroids(*i), 
-            destroy);
-        if (centroids.get())
-        {
-            std::string fname = std::string("G:/testmap/test_results/centroids")
-                + std::to_string(cnt)
-                + std::string(".shp");
-            SaveTmp(fname, centroids.get());
-        }
-
-        //строим граф смежности
-        std::shared_ptr<BridgeGraph>
-            graph(CreateGraph(*i,&bm));
-
-        //вычисляем минимальное остовное дерево графа
-        std::shared_ptr<MinimumSpanningTree>
-            mst(KruskalMST(graph.get()));
-
-        //по минимальному остовному дереву создаем
-        //"островки" при помощи convex hull или отрезка+fixed size buffer
-        TempOGC bridges(CreateBridgesByTree(mst.get(), *i, &bm), destroy);
-
-        //сохраняем для отладки островки по кластерам
-        if (bridges.get())
-        {
-            std::string fname = std::string("G:/testmap/test_results/bridges")
-                + std::to_string(cnt)
-                + std::string(".shp");
-            SaveTmp(fname, bridges.get());
-        }
+        //сетка, которая покрывает полигоны
+        GDALUtilities::RegularGrid grid(input, avg_len);
 
-        for (int i = 0;i < bridges->getNumGeometries();i++)
-            final_bridges->addGeometry(bridges->getGeometryRef(i));
+        //делим полигоны сеткой
+        tiles.reset(SplitGeometryByGrid(input, grid));
 
-        cnt++;
+        //сохраняем тайлы в кэш
+        if (!cacheFile.empty())
+            Tiles::SaveTileCache(cacheFile, tiles.get(), key.value(),
+                avg_len);
     }
+    else
+        std::cout << "tiles loaded from cache \"" << cacheFile << "\""
+            << std::endl;
 
-    //выводим статистику создания мостиков
-    std::cout << "BridgesRPC statistics:\n";
-    std::cout << "\tConvex Hull bridges: " << conv_hull_bridges << std::endl;
-    std::cout << "\tBuffered Line bridges: " << buf_line_bridges << std::endl;
+    //строим граф смежности и его минимальное остовное дерево
+    tiles->computeMetrics();
+    shared_ptr<BridgeGraph> graph(CreateGraph(tiles.get(), max_distance));
+    shared_ptr<MinimumSpanningTree> mst(KruskalMST(graph.get()));
 
-#ifdef BRIDGES_UNION
-    //объединяем мостики с исходной геометрией
-    OGRGeometry *res = bridges->Union(input);
-    //возвращаем геометрию
-    return dynamic_cast<OGRMultiPolygon*>(res);
-#else
-    //ускоренный вариант для отладки алгоритма
-    //bridges->addGeometry(input);
-    //возвращаем геометрию
-    return dynamic_cast<OGC*>(final_bridges->clone());
-#endif
-*/
+    //по ребрам дерева строим мостики
+    return CreateBridgesByTree(mst.get(), tiles.get());
+}
+
+void BridgeConstructor::setCacheFile(const std::string &fileName)
+{
+    cacheFile = fileName;
 }
 
 BridgeConstructor::~BridgeConstructor()
@@ -16,6 +16,9 @@
 #include <algorithm>
 #include <numeric>
 #include <fstream>
+#include <unordered_map>
+#include <map>
+#include <functional>
 //gdal
 #include <gdal_priv.h>
 #include <ogrsf_frmts.h>
@@ -26,9 +29,6 @@
 #include <boost/graph/kruskal_min_spanning_tree.hpp>
 #include <boost/graph/graph_traits.hpp>
 
-#include <boost/serialization/map.hpp>
-#include <boost/archive/text_iarchive.hpp>
-#include <boost/archive/text_oarchive.hpp>
 //использовать только совместно (баг boost 1.6.x)
 #include <boost/type_traits/ice.hpp>
 #include <boost/graph/adjacency_matrix.hpp>
@@ -36,6 +36,7 @@
 #include <clasterutils.h>
 #include <gdalutilities.h>
 #include <tiles.h>
+#include <tilecache.h>
 
 /*!
 \brief Структура хранения данных о графе - списки смежности.
@@ -71,8 +72,8 @@ namespace BridgesRPC
 {
     using namespace GDALUtilities::Boilerplates;
     using std::shared_ptr;
-    using Tiles::Tile;
     using Tiles::TileCollection;
+    using Tiles::TileMetrics;
     ///свойство ребер - вес (для нас - расстояние)
     typedef boost::property<boost::edge_weight_t,
         double> EdgeWeightProperty;
@@ -105,6 +106,62 @@ namespace BridgesRPC
     */
     typedef std::vector<Edge> MinimumSpanningTree;
 
+    /*!
+    \brief Ребро-кандидат графа
+    \details Используется для накопления ребер до создания
+    графа, например в буферах потоков.
+    */
+    struct CandidateEdge
+    {
+        ///индекс тайла - начала ребра
+        int source;
+        ///индекс тайла - конца ребра
+        int target;
+        ///вес ребра (расстояние)
+        double weight;
+    };
+    ///массив ребер-кандидатов
+    typedef std::vector<CandidateEdge> CandidateEdges;
+
+    /*!
+    \brief Пространственный индекс точек тайлов
+    \details Равномерная сетка (spatial hash) с шагом cellSize.
+    Если шаг равен максимальному расстоянию между тайлами, то
+    любые две точки, расстояние между которыми не больше шага,
+    находятся в соседних ячейках. Поэтому для поиска соседей
+    достаточно просмотреть 9 ячеек вокруг точки, а не все точки.
+    */
+    class CentroidGrid
+    {
+        ///ключ ячейки - номер столбца и номер строки
+        typedef std::pair<long long, long long> CellKey;
+        ///хэш ключа ячейки
+        struct CellKeyHash
+        {
+            size_t operator()(const CellKey &k) const;
+        };
+        ///шаг сетки
+        double cellSize;
+        ///номера точек в каждой непустой ячейке
+        std::unordered_map<CellKey, std::vector<int>, CellKeyHash> cells;
+        ///номер ячейки по координате
+        long long cellCoord(double v) const;
+    public:
+        /*!
+        \brief Конструктор
+        \param[in] _cellSize Шаг сетки. Должен быть больше 0.
+        */
+        explicit CentroidGrid(double _cellSize);
+        ///Добавление точки с номером idx
+        void insert(int idx, double x, double y);
+        /*!
+        \brief Кандидаты в соседи точки
+        \details В result добавляются номера точек из ячейки,
+        в которой находится точка (x,y), и из восьми соседних ячеек.
+        */
+        void neighbours(double x, double y, std::vector<int> &result) const;
+    };
+
     ///существует ли файл
     inline bool FileExists(const std::string &fname);
 
@@ -127,10 +184,34 @@ namespace BridgesRPC
     \param[in] grid Сетка, сгенерированная generageGrid
     \param[in] map Структура, которая содержит флаги "соединяемости"
     полигонов
+    \param[in] nthreads Число потоков, 0 - по числу ядер.
+    Полигоны делятся параллельно, индексы тайлов от числа
+    потоков не зависят.
     */
     TileCollection *SplitGeometryByGrid
         (OGRGeometryCollection *input, OGRGeometryCollection *grid,
-            bool verbose = false);
+            bool verbose = false, int nthreads = 0);
+
+    /*!
+    \brief Деление геометрии регулярной сеткой
+    \details Для каждого полигона перебираются только ячейки,
+    которые касаются его bounding box. Их геометрии создаются
+    по мере перебора, сетка целиком в памяти не хранится.
+    \details Если задан vertexBudget, полигоны с большим числом
+    вершин предварительно рекурсивно делятся на квадранты по линиям
+    сетки, пока в куске не останется не больше vertexBudget вершин.
+    Тогда ячейка отсекается только от своего куска, а не от всего
+    полигона. Тайлы полигона в любом случае идут в порядке ячеек.
+    \param[in] input Массив геометрий. Не допускается nullptr.
+    \param[in] grid Сетка
+    \param[in] nthreads Число потоков, 0 - по числу ядер
+    \param[in] vertexBudget Максимальное число вершин в куске
+    полигона, 0 - без предварительного деления
+    \return Новая коллекция тайлов, nullptr если input пустой
+    */
+    TileCollection *SplitGeometryByGrid
+        (OGRGeometryCollection *input, const GDALUtilities::RegularGrid &grid,
+            bool verbose = false, int nthreads = 0, int vertexBudget = 0);
 
     /*!
     \brief Велосипедный расчет расстояния между
@@ -140,6 +221,16 @@ namespace BridgesRPC
     */
     double DistanceBetweenPolygons(OGRPolygon *a, OGRPolygon *b);
 
+    /*!
+    \brief Расстояние между тайлами
+    \details Считается как расстояние между опорными точками
+    тайлов из таблицы характеристик коллекции.
+    \param[in] tiles Коллекция тайлов. Не допускается nullptr.
+    \param[in] idx1 Индекс тайла 1
+    \param[in] idx2 Индекс тайла 2
+    */
+    double DistanceBetweenTiles(TileCollection *tiles, int idx1, int idx2);
+
     /*!
     \brief Создание графа для исходной геометрии
     \details Возвращает новый граф, вершины которого
@@ -149,16 +240,67 @@ namespace BridgesRPC
     \details Без оптимизации граф должен был бы содержать ребра,
     соединяющие все геометрии со всеми. Но произведена оптимизация,
     чтобы не соединять ребрами далекие друг от друга точки.
+    \details Центроиды тайлов раскладываются по CentroidGrid с шагом
+    max_distance, поэтому расстояние считается только для пар тайлов
+    из соседних ячеек, а не для всех пар.
     \param[in] tiles Исходная коллекция тайлов. Не допускается
     nullptr
     \param[in] max_distance Максимальная дистанция, для которой между
     тайлами может быть построен мостик
     \param[in] verbose Если true, то функция пишет в консоль отладочную
     информацию.
-    \return Новый граф
+    \param[in] nthreads Число потоков. Кандидаты в ребра ищутся
+    параллельно в буферах потоков, затем добавляются в граф в порядке
+    индексов тайлов. 0 - по числу ядер.
+    \param[in] partition Номер части (например, кластера) для каждого
+    индекса тайла. Если задан, ребра строятся только между тайлами
+    одной части, и минимальное остовное дерево распадается на деревья
+    частей. nullptr - без ограничения.
+    \return Новый граф. Если max_distance <= 0, граф не содержит
+    ребер.
     */
     BridgeGraph *CreateGraph(TileCollection *tiles, 
-        double max_distance, bool verbose = false);
+        double max_distance, bool verbose = false, int nthreads = 0,
+        const std::vector<int> *partition = nullptr);
+
+    /*!
+    \brief Создание графа по триангуляции Делоне
+    \details Евклидово минимальное остовное дерево является
+    подграфом триангуляции Делоне, поэтому вместо перебора пар
+    тайлов на расстоянии max_distance строится триангуляция
+    опорных точек тайлов (O(n log n), не более 3n ребер).
+    Ребра между тайлами одной группы отбрасываются, как и в
+    CreateGraph. Тайлы с совпадающими опорными точками соединяются
+    ребрами нулевого веса.
+    \details Если все тайлы в разных группах, минимальное остовное
+    дерево совпадает с деревом по CreateGraph с достаточно большим
+    max_distance. Если в группе несколько тайлов, деревья могут
+    отличаться: ребро между разными группами, которого нет в
+    триангуляции (например, через тайл той же группы), в граф
+    не попадает.
+    \details Триангуляцию строит GEOS (нужен GEOS 3.4 и новее).
+    \param[in] tiles Исходная коллекция тайлов. Не допускается
+    nullptr
+    \param[in] verbose Если true, то функция пишет в консоль отладочную
+    информацию.
+    \param[in] nthreads Число потоков для расчета характеристик тайлов.
+    0 - по числу ядер.
+    \return Новый граф. nullptr, если не удалось построить
+    триангуляцию.
+    */
+    BridgeGraph *CreateDelaunayGraph(TileCollection *tiles,
+        bool verbose = false, int nthreads = 0);
+
+    /*!
+    \brief Создание графа из массива ребер
+    \details Ребра сортируются по индексам тайлов, поэтому
+    граф не зависит от порядка, в котором они были найдены.
+    \param[in,out] edges Ребра графа
+    \param[in] nvertices Число вершин графа (число тайлов
+    в коллекции). Индексы тайлов в ребрах должны быть меньше.
+    \return Новый граф
+    */
+    BridgeGraph *GraphFromEdges(CandidateEdges &edges, int nvertices);
 
     /*!
     \brief Создание минимального остовного дерева.
@@ -196,6 +338,38 @@ namespace BridgesRPC
     OGRPolygon *BridgeWithBufferedLine(OGRPolygon *p1,
         OGRPolygon *p2);
 
+    /*!
+    \brief Мостик буферизованным отрезком по характеристикам тайлов
+    \details Отрезок соединяет опорные точки тайлов, ширина
+    буфера - меньший из радиусов вписанных окружностей.
+    Геометрия тайлов при этом не используется, контур мостика
+    строится GDALUtilities::CreateCapsule без GEOS Buffer.
+    \param[in] m1 Характеристики тайла 1
+    \param[in] m2 Характеристики тайла 2
+    \param[in] arcSegments Число отрезков в полукругах на концах
+    \return Новый мостик-полигон в случае успеха,
+    nullptr при ошибке.
+    */
+    OGRPolygon *BridgeWithBufferedLine(const TileMetrics &m1,
+        const TileMetrics &m2, int arcSegments = 60);
+
+    /*!
+    \brief Оценка площади мостика буферизованным отрезком
+    \details Площадь считается аналитически по длине отрезка L
+    между опорными точками и ширине буфера r (меньший из радиусов
+    вписанных окружностей) плюс площадь двух полукругов из
+    arcSegments отрезков. Совпадает с площадью полигона, который
+    строит BridgeWithBufferedLine, но геометрия при этом
+    не строится.
+    \param[in] m1 Характеристики тайла 1
+    \param[in] m2 Характеристики тайла 2
+    \param[in] arcSegments Число отрезков в полукругах на концах
+    \return Оценка площади мостика, или -1, если мостик
+    построить не удастся (не рассчитан радиус).
+    */
+    double EstimateBridgeArea(const TileMetrics &m1,
+        const TileMetrics &m2, int arcSegments = 60);
+
     /*!
     \brief Автоматическое создание мостика
     \details Рассчитывается геометрия мостика между
@@ -218,6 +392,42 @@ namespace BridgesRPC
         OGRPolygon *p2, size_t *counter_ch = nullptr,
         size_t *counter_br = nullptr);
 
+    /*!
+    \brief Автоматическое создание мостика между тайлами
+    \details То же, что AutoBridge для полигонов, но площади,
+    опорные точки и радиусы берутся из таблицы характеристик
+    коллекции.
+    \param[in] tiles Коллекция тайлов. Не допускается nullptr.
+    \param[in] idx1 Индекс тайла 1
+    \param[in] idx2 Индекс тайла 2
+    \return Новый мостик-полигон между двух тайлов
+    в случае успеха, nullptr при ошибке.
+    */
+    OGRPolygon *AutoBridge(TileCollection *tiles, int idx1, int idx2,
+        size_t *counter_ch = nullptr, size_t *counter_br = nullptr);
+
+
+    ///Мостики, по одному на каждое ребро дерева
+    typedef std::vector<OGRPolygon*> BridgeList;
+
+    /*!
+    \brief Параллельное построение мостиков по ребрам дерева
+    \details Мостик для каждого ребра строится независимо
+    функцией AutoBridge. Мостик i-го ребра записывается в i-й
+    элемент результата, поэтому результат одинаков при любом
+    числе потоков.
+    \details OGR создает отдельный контекст GEOS на каждый
+    вызов, поэтому вызовы из разных потоков реентерабельны.
+    \param[in] tree Минимальное остовное дерево. Не допускается
+    nullptr.
+    \param[in] tiles Коллекция тайлов. Не допускается nullptr.
+    \param[in] nthreads Число потоков, 0 - по числу ядер.
+    \return Новый массив мостиков. Элемент равен nullptr, если
+    мостик не удалось построить или тайлы не являются полигонами.
+    Памятью мостиков управляет вызывающая функция.
+    */
+    BridgeList *BuildBridges(MinimumSpanningTree *tree,
+        TileCollection *tiles, int nthreads = 0);
 
     /*!
     \brief Автоматическое создание мостиков по
@@ -230,10 +440,57 @@ namespace BridgesRPC
     nullptr.
     \param[in] tree Инициализированное минимальное остовное
     дерево. Не допускается nullptr.
+    \param[in] nthreads Число потоков, 0 - по числу ядер.
     \return Геометрию мостиков. nullptr в случае ошибки.
     */
     OGC *CreateBridgesByTree(MinimumSpanningTree *tree, 
-        TileCollection *tiles);
+        TileCollection *tiles, int nthreads = 0);
+
+    /*!
+    \brief Упорядоченная пара значений
+    \details Два значения сортируются по возрастанию, т.е.
+    first() <= second(). Используется как ключ пары групп
+    в GroupConnectivityStruct.
+    */
+    class SortedPair
+    {
+        //сама пара значений
+        //уже отсортирована при конструкторе
+        std::pair<int, int> value;
+    public:
+        SortedPair(int x, int y)
+        {
+            value = (x < y) ? std::make_pair(x, y) : std::make_pair(y, x);
+        }
+
+        int first() const { return value.first; }
+        int second() const { return value.second; }
+
+        bool operator<(const SortedPair& p) const
+        {
+            return value < p.value;
+        }
+    };
+
+    /*!
+    \brief Мостики между парами групп
+    \details Каждая пара групп соединяется одним мостиком.
+    */
+    typedef std::map< SortedPair, TempOGC > GroupConnectivityStruct;
+
+    /*!
+    \brief Мостики между парами групп по минимальному остовному дереву
+    \details Для каждой пары групп, которую соединяют ребра дерева,
+    строится только мостик с минимальной оценкой площади
+    (EstimateBridgeArea), остальные ребра пары отбрасываются без
+    построения геометрии.
+    \param[in] tree Минимальное остовное дерево. Не допускается nullptr.
+    \param[in] tiles Коллекция тайлов. Не допускается nullptr.
+    \param[in] nthreads Число потоков, 0 - по числу ядер.
+    \return Новая структура мостиков
+    */
+    GroupConnectivityStruct *GenerateConnectivity(
+        MinimumSpanningTree *tree, TileCollection *tiles, int nthreads = 0);
 
 
     /*!
@@ -267,6 +524,9 @@ namespace BridgesRPC
         */
         double max_distance;
 
+        ///Путь к файлу кэша тайлов, пустая строка - без кэша
+        std::string cacheFile;
+
         /*!
         \brief Определение, соразмерны ли два полигона
         по площади
@@ -292,6 +552,16 @@ namespace BridgesRPC
         */
         OGC *exec();
 
+        /*!
+        \brief Включение кэша тайлов
+        \details Если кэш уже построен для той же исходной
+        геометрии и того же шага сетки, exec() загружает тайлы
+        из него и не делит геометрию сеткой. Иначе тайлы
+        сохраняются в кэш после деления.
+        \param[in] fileName Путь к файлу кэша (см. tilecache.h)
+        */
+        void setCacheFile(const std::string &fileName);
+
         ~BridgeConstructor();
     };
 
@@ -0,0 +1,492 @@
+#include "tilecache.h"
+
+#include <cassert>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <set>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <cpl_conv.h>
+#include <cpl_string.h>
+#include <cpl_vsi.h>
+#include <gdal.h>
+#include <gdal_priv.h>
+#include <ogrsf_frmts.h>
+
+using namespace Tiles;
+
+static_assert(sizeof(TileCacheHeader) == 64,
+    "TileCacheHeader must not contain padding");
+static_assert(sizeof(OGRRawPoint) == 2 * sizeof(double),
+    "OGRRawPoint must be a pair of doubles");
+
+namespace
+{
+    ///сигнатура файла кэша
+    const char TileCacheMagic[8] = { 'M','U','T','I','L','E','S','\0' };
+
+    ///параметры FNV-1a
+    const std::uint64_t FnvOffsetBasis = 14695981039346656037ULL;
+    const std::uint64_t FnvPrime = 1099511628211ULL;
+
+    /*!
+    \brief Файл, отображенный в память только для чтения
+    \details Если файл не удалось открыть или отобразить,
+    data() возвращает nullptr.
+    */
+    class MappedFile
+    {
+        const char *m_data;
+        size_t m_size;
+#ifdef _WIN32
+        HANDLE m_file;
+        HANDLE m_mapping;
+#endif
+        MappedFile(const MappedFile &);
+        MappedFile &operator=(const MappedFile &);
+    public:
+        explicit MappedFile(const std::string &fileName);
+        ~MappedFile();
+        const char *data() const { return m_data; }
+        size_t size() const { return m_size; }
+    };
+
+#ifdef _WIN32
+    MappedFile::MappedFile(const std::string &fileName) :
+        m_data(nullptr), m_size(0), m_file(INVALID_HANDLE_VALUE),
+        m_mapping(NULL)
+    {
+        m_file = CreateFileA(fileName.c_str(), GENERIC_READ,
+            FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL,
+            NULL);
+        if (m_file == INVALID_HANDLE_VALUE)
+            return;
+        LARGE_INTEGER fileSize;
+        if (!GetFileSizeEx(m_file, &fileSize) || fileSize.QuadPart == 0)
+            return;
+        m_mapping = CreateFileMappingA(m_file, NULL, PAGE_READONLY,
+            0, 0, NULL);
+        if (!m_mapping)
+            return;
+        void *view = MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0);
+        if (!view)
+            return;
+        m_data = static_cast<const char*>(view);
+        m_size = static_cast<size_t>(fileSize.QuadPart);
+    }
+
+    MappedFile::~MappedFile()
+    {
+        if (m_data)
+            UnmapViewOfFile(m_data);
+        if (m_mapping)
+            CloseHandle(m_mapping);
+        if (m_file != INVALID_HANDLE_VALUE)
+            CloseHandle(m_file);
+    }
+#else
+    MappedFile::MappedFile(const std::string &fileName) :
+        m_data(nullptr), m_size(0)
+    {
+        int fd = open(fileName.c_str(), O_RDONLY);
+        if (fd < 0)
+            return;
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0)
+        {
+            void *view = mmap(nullptr, static_cast<size_t>(st.st_size),
+                PROT_READ, MAP_PRIVATE, fd, 0);
+            if (view != MAP_FAILED)
+            {
+                m_data = static_cast<const char*>(view);
+                m_size = static_cast<size_t>(st.st_size);
+            }
+        }
+        //отображение остается действительным после закрытия файла
+        close(fd);
+    }
+
+    MappedFile::~MappedFile()
+    {
+        if (m_data)
+            munmap(const_cast<char*>(m_data), m_size);
+    }
+#endif
+
+    ///запись непрерывного массива в поток
+    template <typename T>
+    void WriteArray(std::ofstream &f, const std::vector<T> &v)
+    {
+        if (!v.empty())
+            f.write(reinterpret_cast<const char*>(v.data()),
+                v.size() * sizeof(T));
+    }
+
+    ///проверка таблицы смещений из n + 1 элементов: начинается с 0,
+    ///не убывает и заканчивается на total
+    bool CheckOffsets(const std::int64_t *offsets, std::int64_t n,
+        std::int64_t total)
+    {
+        if (offsets[0] != 0 || offsets[n] != total)
+            return false;
+        for (std::int64_t i = 0;i < n;i++)
+            if (offsets[i + 1] < offsets[i])
+                return false;
+        return true;
+    }
+}
+
+TileCacheKey::TileCacheKey() : m_hash(FnvOffsetBasis)
+{
+
+}
+
+void TileCacheKey::addBytes(const void *data, size_t size)
+{
+    auto bytes = static_cast<const unsigned char*>(data);
+    for (size_t i = 0;i < size;i++)
+    {
+        m_hash ^= bytes[i];
+        m_hash *= FnvPrime;
+    }
+}
+
+void TileCacheKey::addString(const std::string &s)
+{
+    addInt(static_cast<std::int64_t>(s.size()));
+    addBytes(s.data(), s.size());
+}
+
+void TileCacheKey::addInt(std::int64_t v)
+{
+    addBytes(&v, sizeof(v));
+}
+
+void TileCacheKey::addDouble(double v)
+{
+    addBytes(&v, sizeof(v));
+}
+
+bool TileCacheKey::addFile(const std::string &fileName)
+{
+    std::ifstream f(fileName.c_str(), std::ios::binary);
+    if (!f)
+        return false;
+
+    //читаем файл блоками по 1 Мб
+    std::vector<char> buffer(1 << 20);
+    std::int64_t total = 0;
+    while (f)
+    {
+        f.read(buffer.data(), buffer.size());
+        std::streamsize n = f.gcount();
+        addBytes(buffer.data(), static_cast<size_t>(n));
+        total += n;
+    }
+    if (f.bad())
+        return false;
+    //размер отделяет содержимое файла от следующих данных ключа
+    addInt(total);
+    return true;
+}
+
+bool TileCacheKey::addDataset(const std::string &fileName,
+    const std::string &cacheFileName)
+{
+    GDALDataset *dataset = static_cast<GDALDataset*>(GDALOpenEx(
+        fileName.c_str(), GDAL_OF_VECTOR | GDAL_OF_READONLY,
+        nullptr, nullptr, nullptr));
+    if (!dataset)
+        return false;
+
+    //файлы, которые драйвер читает для этого набора данных.
+    //Множество упорядочено, поэтому ключ не зависит от порядка
+    //файлов в каталоге
+    std::set<std::string> files;
+    files.insert(fileName);
+    char **fileList = dataset->GetFileList();
+    for (char **f = fileList;f && *f;f++)
+        files.insert(*f);
+    CSLDestroy(fileList);
+    GDALClose(dataset);
+
+    //не все драйверы сообщают связанные файлы (например, S-57 -
+    //файлы обновлений .001, .002...), поэтому добавляем все файлы
+    //каталога с тем же именем без расширения
+    std::string dir(CPLGetPath(fileName.c_str()));
+    std::string basename(CPLGetBasename(fileName.c_str()));
+    //файл кэша и его временный файл могут лежать рядом
+    //с входным файлом, их в ключ не добавляем
+    std::string cacheName(CPLGetFilename(cacheFileName.c_str()));
+    std::string cacheTmpName = cacheName + ".tmp";
+    char **dirList = VSIReadDir(dir.empty() ? "." : dir.c_str());
+    for (char **f = dirList;f && *f;f++)
+        if (EQUAL(CPLGetBasename(*f), basename.c_str()) &&
+            (cacheName.empty() || (cacheName != *f && cacheTmpName != *f)))
+            files.insert(CPLFormFilename(dir.c_str(), *f, nullptr));
+    CSLDestroy(dirList);
+
+    //число файлов отделяет один набор данных от следующего
+    addInt(static_cast<std::int64_t>(files.size()));
+    bool ok = true;
+    for (auto i = files.begin();i != files.end() && ok;i++)
+        ok = addFile(*i);
+    return ok;
+}
+
+bool Tiles::SaveTileCache(const std::string &fileName,
+    TileCollection *tiles, std::uint64_t key, double gridSize)
+{
+    assert(tiles);
+
+    int ntiles = tiles->size();
+
+    //полигоны всех тайлов и группы
+    std::vector<std::int32_t> groups(ntiles);
+    std::vector<std::int32_t> types(ntiles);
+    std::vector<std::int64_t> tileParts(ntiles + 1, 0);
+    std::vector<OGRPolygon*> parts;
+    for (int i = 0;i < ntiles;i++)
+    {
+        OGRGeometry *g = tiles->geometry(i);
+        OGRwkbGeometryType type = wkbFlatten(g->getGeometryType());
+        if (type == wkbPolygon)
+            parts.push_back(static_cast<OGRPolygon*>(g));
+        else if (type == wkbMultiPolygon)
+        {
+            auto mp = static_cast<OGRMultiPolygon*>(g);
+            for (int j = 0;j < mp->getNumGeometries();j++)
+                parts.push_back(
+                    static_cast<OGRPolygon*>(mp->getGeometryRef(j)));
+        }
+        else
+        {
+            std::cout << "Tile " << i << " is not a polygon, "
+                << "tile cache is not saved" << std::endl;
+            return false;
+        }
+        groups[i] = tiles->group(i);
+        types[i] = type;
+        tileParts[i + 1] = static_cast<std::int64_t>(parts.size());
+    }
+
+    //контуры полигонов: сначала внешний, затем внутренние
+    std::vector<OGRLinearRing*> rings;
+    std::vector<std::int64_t> partRings(parts.size() + 1, 0);
+    for (size_t i = 0;i < parts.size();i++)
+    {
+        OGRPolygon *p = parts[i];
+        if (p->getExteriorRing())
+        {
+            rings.push_back(p->getExteriorRing());
+            for (int j = 0;j < p->getNumInteriorRings();j++)
+                rings.push_back(p->getInteriorRing(j));
+        }
+        partRings[i + 1] = static_cast<std::int64_t>(rings.size());
+    }
+
+    //точки контуров
+    std::vector<std::int64_t> ringPoints(rings.size() + 1, 0);
+    for (size_t i = 0;i < rings.size();i++)
+        ringPoints[i + 1] = ringPoints[i] + rings[i]->getNumPoints();
+
+    TileCacheHeader header;
+    memcpy(header.magic, TileCacheMagic, sizeof(header.magic));
+    header.version = TileCacheVersion;
+    header.headerSize = sizeof(TileCacheHeader);
+    header.key = key;
+    header.gridSize = gridSize;
+    header.ntiles = ntiles;
+    header.nparts = static_cast<std::int64_t>(parts.size());
+    header.nrings = static_cast<std::int64_t>(rings.size());
+    header.npoints = ringPoints.back();
+
+    //пишем во временный файл, чтобы прерванная запись
+    //не испортила кэш
+    std::string tmpName = fileName + ".tmp";
+    {
+        std::ofstream f(tmpName.c_str(),
+            std::ios::binary | std::ios::trunc);
+        if (!f)
+        {
+            std::cout << "Could not create tile cache \""
+                << tmpName << "\"" << std::endl;
+            return false;
+        }
+        f.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        WriteArray(f, groups);
+        WriteArray(f, types);
+        WriteArray(f, tileParts);
+        WriteArray(f, partRings);
+        WriteArray(f, ringPoints);
+        //координаты пишем по контурам через один буфер
+        std::vector<OGRRawPoint> points;
+        for (size_t i = 0;i < rings.size() && f;i++)
+        {
+            points.resize(rings[i]->getNumPoints());
+            rings[i]->getPoints(points.data());
+            WriteArray(f, points);
+        }
+        if (!f)
+        {
+            std::cout << "Failed to write tile cache \""
+                << tmpName << "\"" << std::endl;
+            f.close();
+            std::remove(tmpName.c_str());
+            return false;
+        }
+    }
+
+    //заменяем старый кэш новым
+    std::remove(fileName.c_str());
+    if (std::rename(tmpName.c_str(), fileName.c_str()) != 0)
+    {
+        std::cout << "Could not rename \"" << tmpName << "\" to \""
+            << fileName << "\"" << std::endl;
+        std::remove(tmpName.c_str());
+        return false;
+    }
+    return true;
+}
+
+TileCollection *Tiles::LoadTileCache(const std::string &fileName,
+    std::uint64_t key, double gridSize, double *storedGridSize)
+{
+    //отсутствие кэша - не ошибка
+    MappedFile file(fileName);
+    if (!file.data())
+        return nullptr;
+
+    //проверяем заголовок
+    TileCacheHeader header;
+    if (file.size() < sizeof(header))
+    {
+        std::cout << "\"" << fileName << "\" is not a tile cache"
+            << std::endl;
+        return nullptr;
+    }
+    memcpy(&header, file.data(), sizeof(header));
+    if (memcmp(header.magic, TileCacheMagic, sizeof(header.magic)) != 0 ||
+        header.headerSize != sizeof(TileCacheHeader))
+    {
+        std::cout << "\"" << fileName << "\" is not a tile cache"
+            << std::endl;
+        return nullptr;
+    }
+    if (header.version != TileCacheVersion)
+    {
+        std::cout << "Tile cache \"" << fileName << "\" has version "
+            << header.version << ", expected " << TileCacheVersion
+            << std::endl;
+        return nullptr;
+    }
+    if (header.key != key ||
+        (gridSize > 0 &&
+            fabs(header.gridSize - gridSize) > 1E-9 * gridSize))
+    {
+        std::cout << "Tile cache \"" << fileName << "\" is out of date"
+            << std::endl;
+        return nullptr;
+    }
+
+    //размер файла должен точно соответствовать размерам массивов
+    std::int64_t fileSize = static_cast<std::int64_t>(file.size());
+    bool valid = header.ntiles >= 0 && header.ntiles <= fileSize &&
+        header.nparts >= 0 && header.nparts <= fileSize &&
+        header.nrings >= 0 && header.nrings <= fileSize &&
+        header.npoints >= 0 && header.npoints <= fileSize;
+    if (valid)
+    {
+        std::int64_t expected = sizeof(TileCacheHeader)
+            + 2 * sizeof(std::int32_t) * header.ntiles
+            + sizeof(std::int64_t) * (header.ntiles + 1)
+            + sizeof(std::int64_t) * (header.nparts + 1)
+            + sizeof(std::int64_t) * (header.nrings + 1)
+            + sizeof(OGRRawPoint) * header.npoints;
+        valid = expected == fileSize;
+    }
+
+    //массивы выровнены по 8 байт, поэтому используются
+    //прямо из отображенного файла
+    const char *p = file.data() + sizeof(TileCacheHeader);
+    const std::int32_t *groups = nullptr;
+    const std::int32_t *types = nullptr;
+    const std::int64_t *tileParts = nullptr;
+    const std::int64_t *partRings = nullptr;
+    const std::int64_t *ringPoints = nullptr;
+    const OGRRawPoint *points = nullptr;
+    if (valid)
+    {
+        groups = reinterpret_cast<const std::int32_t*>(p);
+        p += sizeof(std::int32_t) * header.ntiles;
+        types = reinterpret_cast<const std::int32_t*>(p);
+        p += sizeof(std::int32_t) * header.ntiles;
+        tileParts = reinterpret_cast<const std::int64_t*>(p);
+        p += sizeof(std::int64_t) * (header.ntiles + 1);
+        partRings = reinterpret_cast<const std::int64_t*>(p);
+        p += sizeof(std::int64_t) * (header.nparts + 1);
+        ringPoints = reinterpret_cast<const std::int64_t*>(p);
+        p += sizeof(std::int64_t) * (header.nrings + 1);
+        points = reinterpret_cast<const OGRRawPoint*>(p);
+
+        valid = CheckOffsets(tileParts, header.ntiles, header.nparts) &&
+            CheckOffsets(partRings, header.nparts, header.nrings) &&
+            CheckOffsets(ringPoints, header.nrings, header.npoints);
+        //полигон - ровно одна часть
+        for (std::int64_t i = 0;i < header.ntiles && valid;i++)
+            valid = (types[i] == wkbPolygon &&
+                tileParts[i + 1] - tileParts[i] == 1) ||
+                types[i] == wkbMultiPolygon;
+    }
+    if (!valid)
+    {
+        std::cout << "Tile cache \"" << fileName << "\" is corrupted"
+            << std::endl;
+        return nullptr;
+    }
+
+    //строим тайлы из отображенных массивов
+    auto tiles = new TileCollection;
+    for (std::int64_t i = 0;i < header.ntiles;i++)
+    {
+        OGRMultiPolygon *mp = nullptr;
+        if (types[i] == wkbMultiPolygon)
+            mp = new OGRMultiPolygon;
+        OGRPolygon *poly = nullptr;
+        for (std::int64_t k = tileParts[i];k < tileParts[i + 1];k++)
+        {
+            poly = new OGRPolygon;
+            for (std::int64_t r = partRings[k];r < partRings[k + 1];r++)
+            {
+                auto ring = new OGRLinearRing;
+                //setPoints только копирует точки
+                ring->setPoints(
+                    static_cast<int>(ringPoints[r + 1] - ringPoints[r]),
+                    const_cast<OGRRawPoint*>(points + ringPoints[r]));
+                poly->addRingDirectly(ring);
+            }
+            if (mp)
+                mp->addGeometryDirectly(poly);
+        }
+        if (mp)
+            tiles->addTile(mp, groups[i]);
+        else
+            tiles->addTile(poly, groups[i]);
+    }
+
+    if (storedGridSize)
+        *storedGridSize = header.gridSize;
+    return tiles;
+}
@@ -0,0 +1,147 @@
+/*!
+\file
+\brief Двоичный кэш коллекции тайлов
+\details Кэш позволяет не делить исходную геометрию сеткой
+повторно, если входные данные и шаг сетки не изменились.
+\details Формат файла (версия 1):
+\details 1. Заголовок TileCacheHeader: сигнатура, версия, ключ
+входных данных, шаг сетки и размеры массивов.
+\details 2. Массив групп тайлов (int32, ntiles) и массив типов
+тайлов (int32, ntiles: wkbPolygon или wkbMultiPolygon).
+\details 3. Таблицы смещений (int64): для тайла - первый полигон
+(ntiles + 1), для полигона - первый контур (nparts + 1),
+для контура - первая точка (nrings + 1).
+\details 4. Плоский массив координат x,y всех точек (double,
+2 * npoints).
+\details Все массивы выровнены по 8 байт, порядок байт - порядок
+байт машины, на которой записан кэш. При загрузке файл
+отображается в память, и контуры строятся прямо из отображенного
+массива координат.
+
+\author Владимир Иноземцев
+\version 1.0
+*/
+
+#ifndef TILE_CACHE_H
+#define TILE_CACHE_H
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+
+#include <tiles.h>
+
+namespace Tiles
+{
+    ///Текущая версия формата кэша тайлов
+    const std::uint32_t TileCacheVersion = 1;
+
+    /*!
+    \brief Заголовок файла кэша тайлов
+    */
+    struct TileCacheHeader
+    {
+        ///сигнатура "MUTILES"
+        char magic[8];
+        ///версия формата
+        std::uint32_t version;
+        ///размер заголовка в байтах
+        std::uint32_t headerSize;
+        ///ключ входных данных (TileCacheKey)
+        std::uint64_t key;
+        ///шаг сетки, которой поделены тайлы
+        double gridSize;
+        ///число тайлов
+        std::int64_t ntiles;
+        ///число полигонов во всех тайлах
+        std::int64_t nparts;
+        ///число контуров во всех полигонах
+        std::int64_t nrings;
+        ///число точек во всех контурах
+        std::int64_t npoints;
+    };
+
+    /*!
+    \brief Ключ кэша тайлов
+    \details Хэш FNV-1a (64 бита) от всех данных, от которых
+    зависит результат деления: содержимого входных файлов, имени
+    слоя, параметров деления. Данные добавляются в ключ по очереди,
+    порядок добавления важен.
+    */
+    class TileCacheKey
+    {
+        ///текущее значение хэша
+        std::uint64_t m_hash;
+    public:
+        explicit TileCacheKey();
+        ///Добавление произвольных байт
+        void addBytes(const void *data, size_t size);
+        ///Добавление строки вместе с ее длиной
+        void addString(const std::string &s);
+        ///Добавление целого числа
+        void addInt(std::int64_t v);
+        ///Добавление вещественного числа
+        void addDouble(double v);
+        /*!
+        \brief Добавление содержимого файла
+        \return false, если файл не удалось прочитать
+        */
+        bool addFile(const std::string &fileName);
+        /*!
+        \brief Добавление содержимого всех файлов набора данных
+        \details Набор данных открывается через GDAL, и в ключ
+        добавляются все файлы из GDALDataset::GetFileList()
+        (например, .shx и .dbf шейп-файла) и все файлы каталога
+        с тем же именем без расширения (например, файлы обновлений
+        .001, .002... карты S-57, которые GDAL применяет при
+        открытии). Файлы добавляются в порядке имен.
+        \param[in] fileName Путь к набору данных
+        \param[in] cacheFileName Путь к файлу кэша. Если он лежит
+        рядом с набором данных и имеет то же имя без расширения,
+        он не добавляется в ключ.
+        \return false, если набор данных или один из его файлов
+        не удалось прочитать
+        */
+        bool addDataset(const std::string &fileName,
+            const std::string &cacheFileName = std::string());
+        ///Значение ключа
+        std::uint64_t value() const { return m_hash; }
+    };
+
+    /*!
+    \brief Сохранение коллекции тайлов в файл кэша
+    \details Файл сначала пишется во временный файл рядом с
+    fileName и только затем переименовывается, поэтому прерванная
+    запись не оставляет испорченный кэш.
+    \param[in] fileName Путь к файлу кэша
+    \param[in] tiles Коллекция тайлов. Не допускается nullptr.
+    Сохраняются только тайлы - полигоны и мультиполигоны.
+    \param[in] key Ключ входных данных (TileCacheKey::value())
+    \param[in] gridSize Шаг сетки, которой поделены тайлы
+    \return true в случае успеха. false, если файл не удалось
+    записать или в коллекции есть тайлы другого типа.
+    */
+    bool SaveTileCache(const std::string &fileName,
+        TileCollection *tiles, std::uint64_t key, double gridSize);
+
+    /*!
+    \brief Загрузка коллекции тайлов из файла кэша
+    \details Файл отображается в память, заголовок и таблицы
+    смещений проверяются, затем из них строятся геометрии тайлов.
+    Индексы и группы тайлов совпадают с сохраненной коллекцией.
+    \param[in] fileName Путь к файлу кэша
+    \param[in] key Ожидаемый ключ входных данных
+    \param[in] gridSize Ожидаемый шаг сетки. Если не больше 0,
+    то шаг сетки не проверяется (например, если он сам
+    рассчитывается по входным данным, которые уже вошли в ключ).
+    \param[out] storedGridSize Если не nullptr, сюда записывается
+    шаг сетки из файла кэша
+    \return Новая коллекция тайлов. nullptr, если файла нет,
+    у него другая версия, ключ или шаг сетки, или файл испорчен.
+    */
+    TileCollection *LoadTileCache(const std::string &fileName,
+        std::uint64_t key, double gridSize = 0,
+        double *storedGridSize = nullptr);
+}
+
+#endif
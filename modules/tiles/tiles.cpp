@@ -1,23 +1,65 @@
 #include "tiles.h"
 
+#include <algorithm>
 #include <cassert>
 
 #include <gdal_priv.h>
 #include <ogrsf_frmts.h>
 
-using namespace Tiles;
+#include <gdalutilities.h>
 
-//Инициализируем счетчик тайлов
-int Tile::counter = 0;
+using namespace Tiles;
 
-Tile::Tile(OGRGeometry * g, int group)
+TileMetrics Tiles::ComputeTileMetrics(OGRGeometry *g)
 {
     assert(g);
-    //геометрию добавляем
-    m_geometry = g;
-    //номер тайла - из статического счетчика
-    m_index = counter++;
-    m_group = group;
+
+    TileMetrics m;
+    g->getEnvelope(&m.envelope);
+    m.center.x = (m.envelope.MinX + m.envelope.MaxX) / 2;
+    m.center.y = (m.envelope.MinY + m.envelope.MaxY) / 2;
+    m.area = 0;
+    m.inscribedRadius = -1;
+    m.vertexCount = 0;
+
+    //остальные характеристики считаем только для полигонов
+    if (g->getGeometryType() != wkbPolygon)
+        return m;
+    auto p = static_cast<OGRPolygon*>(g);
+
+    m.area = p->get_Area();
+
+    //опорная точка - полюс недоступности, за один проход
+    //получаем и точку внутри полигона, и радиус вписанной окружности.
+    //Точность - 1% меньшей стороны bounding box
+    double precision = 0.01 * std::min(
+        m.envelope.MaxX - m.envelope.MinX,
+        m.envelope.MaxY - m.envelope.MinY);
+    auto pole = GDALUtilities::PoleOfInaccessibility(p, precision);
+    if (std::get<1>(pole) > 0)
+    {
+        m.center = std::get<0>(pole);
+        m.inscribedRadius = std::get<1>(pole);
+    }
+    else
+    {
+        //вырожденный полигон, считаем по центроиду
+        std::shared_ptr<OGRPoint>
+            c(GDALUtilities::FailsafeCentroid(p),
+                OGRGeometryFactory::destroyGeometry);
+        m.center.x = c->getX();
+        m.center.y = c->getY();
+        m.inscribedRadius =
+            GDALUtilities::InscribedCircleRadius(p, c.get());
+    }
+
+    //число вершин во всех контурах
+    if (p->getExteriorRing())
+        m.vertexCount += p->getExteriorRing()->getNumPoints();
+    for (int i = 0;i < p->getNumInteriorRings();i++)
+        m.vertexCount += p->getInteriorRing(i)->getNumPoints();
+
+    return m;
 }
 
 TileCollection::TileCollection()
@@ -25,21 +67,27 @@ TileCollection::TileCollection()
 
 }
 
-void TileCollection::addTile(Tile * t)
+TileCollection::~TileCollection()
 {
-    assert(t);
-
-    //создаем новый элемент коллекции
-    std::pair< int, std::shared_ptr<Tile> > newNode
-        = std::make_pair(
-            //ключ - индекс тайла
-            t->index(),
-            //значение - умный указатель на тайл
-            std::shared_ptr<Tile>(t)
-            );
-
-    //добавляем элемент
-    collection.insert(newNode);
+    //коллекция владеет геометриями тайлов
+    for (auto i = m_geometries.begin();i != m_geometries.end();i++)
+        OGRGeometryFactory::destroyGeometry(*i);
+}
+
+int TileCollection::addTile(OGRGeometry *g, int group)
+{
+    assert(g);
+
+    std::lock_guard<std::mutex> lock(m_addMutex);
+
+    //индекс нового тайла - его позиция в массивах
+    int idx = size();
+    m_geometries.push_back(g);
+    m_groups.push_back(group);
+    m_metrics.push_back(TileMetrics());
+    m_hasMetrics.push_back(0);
+
+    return idx;
 }
 
 int TileCollection::countGroups()
@@ -48,10 +96,10 @@ int TileCollection::countGroups()
     int ngroups = 0;
 
     //ищем максимум среди номеров групп в тайлах коллекции
-    for (auto i = collection.begin();i != collection.end();i++)
+    for (auto i = m_groups.begin();i != m_groups.end();i++)
     {
         //текущая группа
-        int curGroup = (*i).second->group();
+        int curGroup = (*i);
         
         if (curGroup > ngroups)
             ngroups = curGroup;
@@ -68,9 +116,9 @@ int TileCollection::countTilesInGroup(int grp)
     //перебираем всю коллекцию
     //если тайл находится в группе, инкрементируем
     //счетчик
-    for (auto i = collection.begin();i != collection.end();i++)
+    for (auto i = m_groups.begin();i != m_groups.end();i++)
     {
-        if ((*i).second->group() == grp) ntiles++;
+        if ((*i) == grp) ntiles++;
     }
 
     return ntiles;
@@ -78,7 +126,32 @@ int TileCollection::countTilesInGroup(int grp)
 
 bool TileCollection::inSameGroup(int idx1, int idx2)
 {
-    return
-        (collection.at(idx1)->group() ==
-            collection.at(idx2)->group());
+    return group(idx1) == group(idx2);
+}
+
+const TileMetrics &TileCollection::metrics(int idx)
+{
+    assert(idx >= 0 && idx < size());
+
+    //еще не считали, считаем и запоминаем
+    if (!m_hasMetrics[idx])
+    {
+        m_metrics[idx] = ComputeTileMetrics(m_geometries[idx]);
+        m_hasMetrics[idx] = 1;
+    }
+    return m_metrics[idx];
+}
+
+void TileCollection::computeMetrics(int nthreads)
+{
+    //каждый поток пишет в свой элемент массива
+    int n = size();
+#pragma omp parallel for schedule(dynamic, 64) \
+    num_threads(GDALUtilities::ThreadCount(nthreads))
+    for (int i = 0;i < n;i++)
+    {
+        if (m_hasMetrics[i]) continue;
+        m_metrics[i] = ComputeTileMetrics(m_geometries[i]);
+        m_hasMetrics[i] = 1;
+    }
 }
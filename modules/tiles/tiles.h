@@ -8,63 +8,113 @@
 #ifndef TILES_H
 #define TILES_H
 
-class OGRGeometry;
-#include <map>
-#include <memory>
+#include <ogr_geometry.h>
+#include <cassert>
+#include <mutex>
+#include <vector>
 
 namespace Tiles
 {
-    ///Тип геометрии тайла
-    class Tile
+    /*!
+    \brief Характеристики геометрии тайла
+    \details Рассчитываются один раз для каждого тайла и
+    используются при построении графа и мостиков вместо
+    повторных вызовов GEOS.
+    */
+    struct TileMetrics
     {
-        ///статический счетчик индексов
-        static int counter;
-        ///указатель на геометрию GDAL
-        OGRGeometry *m_geometry;
-        ///уникальный индекс тайла
-        int m_index;
-        ///группа тайла
-        int m_group;
-    public:
-        explicit Tile(OGRGeometry *g, int group);
-        int index() { return m_index; }
-        int group() { return m_group; }
-        OGRGeometry *geometry() { return m_geometry; }
+        ///опорная точка тайла (полюс недоступности)
+        OGRRawPoint center;
+        ///площадь
+        double area;
+        ///bounding box
+        OGREnvelope envelope;
+        ///радиус вписанной окружности с центром в опорной точке,
+        ///-1 в случае ошибки
+        double inscribedRadius;
+        ///число вершин во всех контурах
+        int vertexCount;
     };
 
-    ///массив тайлов
-    ///позволяет быстро найти тайл
-    ///по индексу
-
-    typedef std::map< int, std::shared_ptr<Tile> > TileMap;
-    typedef TileMap::iterator TileMapIterator;
+    /*!
+    \brief Расчет характеристик геометрии тайла
+    \param[in] g Геометрия тайла. Не допускается nullptr.
+    \return Характеристики тайла. Для геометрий, которые
+    не являются полигонами, опорная точка - центр bounding box,
+    площадь 0, радиус -1.
+    */
+    TileMetrics ComputeTileMetrics(OGRGeometry *g);
 
+    /*!
+    \brief Коллекция тайлов
+    \details Данные тайлов хранятся в отдельных непрерывных
+    массивах (геометрии, группы, характеристики). Индексы тайлов
+    выдаются коллекцией подряд начиная с 0, поэтому индекс тайла
+    совпадает с его позицией в массивах, а тайлы коллекции
+    перебираются циклом от 0 до size() - 1.
+    Коллекция владеет геометриями тайлов и удаляет их
+    в деструкторе.
+    */
     class TileCollection
     {
-        //используются умные указатели для автоматического
-        //управления памятью
-        //ключ - индекс тайла
-        ///ассоциативный массив тайлов
-        std::map< int, std::shared_ptr<Tile> > collection;
+        ///защищает добавление тайлов из разных потоков
+        std::mutex m_addMutex;
+        ///геометрии тайлов
+        std::vector<OGRGeometry*> m_geometries;
+        ///группы тайлов
+        std::vector<int> m_groups;
+        ///характеристики тайлов
+        std::vector<TileMetrics> m_metrics;
+        ///признак того, что характеристики рассчитаны
+        std::vector<char> m_hasMetrics;
+
+        TileCollection(const TileCollection &);
+        TileCollection &operator=(const TileCollection &);
     public:
         explicit TileCollection();
+        ~TileCollection();
         ///Добавление нового тайла в коллекцию. Управление
-        ///памятью тайла теперь осуществляет TileCollection
-        void addTile(Tile *t);
+        ///памятью геометрии теперь осуществляет TileCollection.
+        ///Можно вызывать из нескольких потоков.
+        ///\return индекс нового тайла
+        int addTile(OGRGeometry *g, int group);
         ///Число групп
         int countGroups();
         ///Число тайлов в группе
         int countTilesInGroup(int grp);
         ///Общее число тайлов
-        int size() { return collection.size(); }
-        ///Тайл по индексу
-        ///Не удалять, используется внутренней логикой!
-        Tile *tileByIndex(int idx) { return collection.at(idx).get(); }
+        int size() { return static_cast<int>(m_geometries.size()); }
+        ///Геометрия тайла по индексу
+        OGRGeometry *geometry(int idx)
+        {
+            assert(idx >= 0 && idx < size());
+            return m_geometries[idx];
+        }
+        ///Группа тайла по индексу
+        int group(int idx)
+        {
+            assert(idx >= 0 && idx < size());
+            return m_groups[idx];
+        }
         ///Проверка, находятся ли тайлы в одной группе
         bool inSameGroup(int idx1, int idx2);
-        ///Итераторы
-        TileMapIterator begin() { return collection.begin(); }
-        TileMapIterator end() { return collection.end(); }
+        /*!
+        \brief Характеристики тайла по индексу
+        \details Если характеристики еще не рассчитаны, они
+        рассчитываются и запоминаются при первом обращении без
+        синхронизации. Поэтому из нескольких потоков metrics()
+        можно вызывать только после computeMetrics(), когда
+        таблица характеристик только читается.
+        */
+        const TileMetrics &metrics(int idx);
+        /*!
+        \brief Расчет характеристик всех тайлов коллекции
+        \details Вызывается перед параллельными участками,
+        которые читают metrics(). Одновременно с metrics()
+        или addTile() вызывать нельзя.
+        \param[in] nthreads Число потоков, 0 - по числу ядер
+        */
+        void computeMetrics(int nthreads = 0);
     };
     
 }
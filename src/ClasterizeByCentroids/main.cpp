@@ -198,42 +198,30 @@ int main(int argc, char *argv[])
         //текущая фича
         OGRFeature *currentFeature;
 
-        //смотрим, сколько фич в слое
-        int nfeatures = 0;
-        currentLayer->ResetReading();
-        while ((currentFeature = currentLayer->GetNextFeature()) != nullptr)
-        {
-            nfeatures++;
-            //не забываем удалять, это копия объекта
-            OGRFeature::DestroyFeature(currentFeature);
-        }
-
-        //для найденного количества фич инициализируем данные KMdata
-        dataPoints = new KMdata(2, nfeatures);
+        //число фич нужно только для прогресса, поэтому берем его,
+        //только если драйвер считает его без чтения слоя
+        std::shared_ptr<GDALUtilities::ProgressIndicator> indicator;
+        if (currentLayer->TestCapability(OLCFastFeatureCount))
+            indicator = std::make_shared<GDALUtilities::ProgressIndicator>(
+                static_cast<int>(currentLayer->GetFeatureCount()),
+                "Reading file");
 
-        //читаем feature заново, считая центроиды
+        //за один проход собираем центроиды полигонов
+        //и FID их фич
+        std::vector<double> coords;
+        std::vector<GIntBig> fids;
         currentLayer->ResetReading();
-        int featureCounter = 0;
-        //красивый прогресс
-        GDALUtilities::ProgressIndicator 
-            indicator(currentLayer->GetFeatureCount(),
-                "Reading file");
-        //просматриваем все фичи заново
         while ((currentFeature = currentLayer->GetNextFeature()) != nullptr)
         {
             //отображаем прогресс в консоли
-            indicator.incOperationCount();
+            if (indicator)
+                indicator->incOperationCount();
             //геометрия из входного файла
             OGRGeometry *currentGeometry;
             currentGeometry = currentFeature->GetGeometryRef();
-            //если нет геометрии в currentFeature, пропускаем его
-            if (!currentGeometry)
-            {
-                OGRFeature::DestroyFeature(currentFeature);
-                continue;
-            }
-            //если геометрия не того типа, пропускаем feature
-            if (currentGeometry->getGeometryType() != wkbPolygon)
+            //если геометрия не того типа или ее нет, пропускаем feature
+            if (!currentGeometry ||
+                currentGeometry->getGeometryType() != wkbPolygon)
             {
                 OGRFeature::DestroyFeature(currentFeature);
                 continue;
@@ -242,45 +230,43 @@ int main(int argc, char *argv[])
             shared_ptr<OGRPoint> centroid(
             GDALUtilities::FailsafeCentroid(currentGeometry),
                 destroy);
-            //перегоняем данные в KMlocal
-            KMpoint &p = (*dataPoints)[featureCounter];
-            p[0] = centroid->getX();
-            p[1] = centroid->getY();
+            coords.push_back(centroid->getX());
+            coords.push_back(centroid->getY());
+            fids.push_back(currentFeature->GetFID());
 
             //освобождаем память фичи
             OGRFeature::DestroyFeature(currentFeature);
-
-            featureCounter++;
         }
 
-        //запускаем алгоритм кластеризации
-        ClasterCore();
+        int npolygons = static_cast<int>(fids.size());
+        if (npolygons == 0)
+        {
+            std::cout << "Layer does not contain polygons" << std::endl;
+            GDALClose(inputDataset);
+            continue;
+        }
 
-        //изменяем поле clasternum у каждой фичи
-        currentLayer->ResetReading();
-        featureCounter = 0;
-        //просматриваем все фичи заново
-        while ((currentFeature = currentLayer->GetNextFeature()) != nullptr)
+        //перегоняем данные в KMlocal
+        dataPoints = new KMdata(2, npolygons);
+        for (int k = 0;k < npolygons;k++)
         {
-            //берем индекс кластера из массива
-            int claster_idx = closeCtr[featureCounter++];
-            //в фиче меняем поле
-            currentFeature->SetField("clasternum", 
-                claster_idx);
-            //перезаписываем фичу в файле
-            currentLayer->SetFeature(currentFeature);
-            //освобождаем память фичи
-            OGRFeature::DestroyFeature(currentFeature);
+            KMpoint &p = (*dataPoints)[k];
+            p[0] = coords[2 * k];
+            p[1] = coords[2 * k + 1];
         }
 
-        //теперь записываем геометрии кластеров в отдельные файлы
+        //запускаем алгоритм кластеризации
+        ClasterCore();
+
+        //слои кластеров создаем до прохода по фичам
+        std::vector<OGRLayer*> clasterLayers(nclasters);
         for (int i = 0;i < nclasters;i++)
         {
             //имя слоя, соответствующего кластеру i
             string lname("claster_");
             lname.append(std::to_string(i));
 
-            std::cout << "processing layer \"" <<
+            std::cout << "creating layer \"" <<
                 lname << "\"" << std::endl;
 
             //инициализация нового слоя
@@ -306,38 +292,78 @@ int main(int argc, char *argv[])
                     exit(1);
                 }
             }
+            clasterLayers[i] = newLayer;
+        }
 
-            //текст фильтра для фич
-            string filter_str("clasternum=");
-            filter_str.append(std::to_string(i));
-            //применяем фильтр
-            currentLayer->SetAttributeFilter(filter_str.c_str());
-            //просматриваем все фичи, соответствующие фильтру
-            currentLayer->ResetReading();
-            while ((currentFeature = currentLayer->GetNextFeature()) != nullptr)
-            {
-                //создаем новую фичу в слое кластера
-                OGRFeature *poFeature;
-                poFeature = OGRFeature::CreateFeature(newLayer->GetLayerDefn());
+        //все изменения файла выполняем в одной транзакции датасета,
+        //если драйвер ее поддерживает. Тогда writer'ы слоев
+        //свои транзакции не открывают
+        bool datasetTransaction =
+            inputDataset->TestCapability(ODsCTransactions) &&
+            inputDataset->StartTransaction() == OGRERR_NONE;
+        //все слои кластеров находятся в одном датасете, а датасет GDAL
+        //нельзя использовать из нескольких потоков, поэтому пишем
+        //в один поток
+        std::vector< std::shared_ptr<GDALUtilities::FeatureWriter> >
+            writers(nclasters);
+        for (int i = 0;i < nclasters;i++)
+            writers[i] = std::make_shared<GDALUtilities::FeatureWriter>(
+                clasterLayers[i], 10000, !datasetTransaction);
 
-                //из фичи копируем все атрибуты и геометрию
-                if (OGR_F_SetFrom(poFeature, currentFeature, true) != OGRERR_NONE)
+        //за один проход записываем clasternum в каждую фичу и копируем
+        //ее в слой кластера. Фичи читаются в том же порядке, поэтому
+        //номер кластера следующего полигона ищем по его FID
+        currentLayer->ResetReading();
+        int featureCounter = 0;
+        while ((currentFeature = currentLayer->GetNextFeature()) != nullptr)
+        {
+            if (featureCounter < npolygons &&
+                currentFeature->GetFID() == fids[featureCounter])
+            {
+                //берем индекс кластера из массива
+                int claster_idx = closeCtr[featureCounter++];
+                //в фиче меняем поле
+                currentFeature->SetField("clasternum",
+                    claster_idx);
+                //перезаписываем фичу в файле
+                currentLayer->SetFeature(currentFeature);
+
+                GDALUtilities::FeatureWriter &writer = *writers[claster_idx];
+                //геометрию забираем из фичи, чтобы не копировать ее
+                OGRGeometry *geometry = currentFeature->StealGeometry();
+                //из фичи копируем все атрибуты
+                if (writer.feature()->SetFrom(currentFeature, TRUE) != OGRERR_NONE)
                 {
                     std::cout << "Copying feature failed."
                         << std::endl;
                 }
 
-                //создаем фичу на слое
-                if (newLayer->CreateFeature(poFeature) != OGRERR_NONE)
+                //создаем фичу на слое кластера
+                if (!writer.writeDirectly(geometry))
                 {
                     std::cout << "Failed to save the feature."
                         << std::endl;
                     exit(1);
                 }
+            }
+            //освобождаем память фичи
+            OGRFeature::DestroyFeature(currentFeature);
+        }
 
-                //освобождаем память фичи
-                OGRFeature::DestroyFeature(poFeature);
+        for (int i = 0;i < nclasters;i++)
+            if (!writers[i]->commit())
+            {
+                std::cout << "Failed to save the features."
+                    << std::endl;
+                exit(1);
             }
+        writers.clear();
+        if (datasetTransaction &&
+            inputDataset->CommitTransaction() != OGRERR_NONE)
+        {
+            std::cout << "Failed to commit changes."
+                << std::endl;
+            exit(1);
         }
         GDALClose(inputDataset);
     }
@@ -0,0 +1,310 @@
+/*!
+\file
+\brief Построение мостиков без промежуточных файлов
+\details Программа выполняет работу Splitter, ClasterizeByCentroids
+и Bridges за один запуск: делит исходные полигоны регулярной сеткой
+на тайлы, кластеризует тайлы по опорным точкам и строит мостики
+между тайлами каждого кластера.
+\details Коллекция тайлов хранится в памяти между этапами, на диск
+записываются только мостики. Для отладки тайлы с номерами групп и
+кластеров можно сохранить опцией -dump.
+\details С опцией -cache тайлы сохраняются в двоичный кэш, и при
+повторном запуске с теми же входными файлами (например, с другим
+числом кластеров) исходные полигоны не читаются и не делятся.
+
+\author Владимир Иноземцев
+\version 1.0
+*/
+
+//gdal
+#include <gdal.h>
+#include <gdal_priv.h>
+#include <ogr_feature.h>
+#include <ogrsf_frmts.h>
+//std
+#include <memory>
+#include <string.h>
+#include <vector>
+#include <iostream>
+#include <assert.h>
+//мои модули
+#include <gdalutilities.h>
+#include <clasterutils.h>
+#include <rpcbridges_dev.h>
+#include <tiles.h>
+#include <tilecache.h>
+
+using namespace GDALUtilities::Boilerplates;
+
+//запись тайлов с индексом, группой и номером кластера,
+//как их записывают Splitter и ClasterizeByCentroids
+static bool DumpTiles(Tiles::TileCollection *tiles,
+    const std::vector<int> &clasters, GDALDriver *driver,
+    const std::string &fileName)
+{
+    GDALDataset *dataset = driver->Create(fileName.c_str(),
+        0, 0, 0, GDT_Unknown, NULL);
+    if (!dataset)
+    {
+        std::cout << "Could not create dataset \""
+            << fileName << "\"" << std::endl;
+        return false;
+    }
+    OGRLayer *layer = dataset->CreateLayer("tiles", NULL, wkbPolygon, NULL);
+    OGRFieldDefn oIndexField("index", OFTInteger);
+    OGRFieldDefn oGroupField("group", OFTInteger);
+    OGRFieldDefn oClasterField("clasternum", OFTInteger);
+    if (!layer ||
+        layer->CreateField(&oIndexField) != OGRERR_NONE ||
+        layer->CreateField(&oGroupField) != OGRERR_NONE ||
+        layer->CreateField(&oClasterField) != OGRERR_NONE)
+    {
+        std::cout << "Could not create layer in \""
+            << fileName << "\"" << std::endl;
+        GDALClose(dataset);
+        return false;
+    }
+
+    bool ok = true;
+    {
+        GDALUtilities::FeatureWriter writer(layer);
+        for (int i = 0;i < tiles->size() && ok;i++)
+        {
+            writer.feature()->SetField("index", i);
+            writer.feature()->SetField("group", tiles->group(i));
+            writer.feature()->SetField("clasternum", clasters[i]);
+            ok = writer.write(tiles->geometry(i));
+        }
+        ok = writer.commit() && ok;
+    }
+    if (!ok)
+        std::cout << "Failed to write tiles" << std::endl;
+    GDALClose(dataset);
+    return ok;
+}
+
+int main(int argc, char *argv[])
+{
+    //аргументы командной строки
+    GDALUtilities::StringList args(argv + 1, argv + argc);
+
+    //число потоков, 0 - по числу ядер
+    int nthreads = 0;
+    std::string option;
+    if (GDALUtilities::TakeOption(args, "-threads", option))
+        nthreads = atoi(option.c_str());
+    //максимальное число вершин в куске полигона при делении
+    int vertexBudget = 0;
+    if (GDALUtilities::TakeOption(args, "-budget", option))
+        vertexBudget = atoi(option.c_str());
+    //число кластеров
+    int nclasters = 10;
+    if (GDALUtilities::TakeOption(args, "-clasters", option))
+        nclasters = atoi(option.c_str());
+    //файл для отладочной записи тайлов
+    std::string dumpFileName;
+    GDALUtilities::TakeOption(args, "-dump", dumpFileName);
+    //файл кэша тайлов
+    std::string cacheFileName;
+    GDALUtilities::TakeOption(args, "-cache", cacheFileName);
+    //максимальное расстояние между опорными точками тайлов,
+    //которые соединяются ребром графа. 0 - по шагу сетки
+    double maxDistance = 0;
+    if (GDALUtilities::TakeOption(args, "-max_distance", option))
+        maxDistance = atof(option.c_str());
+
+    //проверяем аргументы командной строки
+    if (args.size() < 4 || nclasters < 1 || maxDistance < 0)
+    {
+        std::cout << "USAGE: Pipeline "
+            << "[-threads <n>] [-budget <n>] [-clasters <n>] "
+            << "[-max_distance <d>] "
+            << "[-dump <tiles_file>] [-cache <cache_file>] "
+            << "<in1> .. <inN> "
+            << "<layer_name> <driver> <outfile>"
+            << std::endl;
+        std::cout << "-threads <n> - number of threads, "
+            << "all cores by default" << std::endl;
+        std::cout << "-budget <n> - split polygons with more "
+            << "than n vertices into quadrants before "
+            << "clipping by grid" << std::endl;
+        std::cout << "-clasters <n> - number of tile clasters, "
+            << "10 by default" << std::endl;
+        std::cout << "-max_distance <d> - maximum distance between "
+            << "connected tiles in map units, "
+            << "3 grid cells by default" << std::endl;
+        std::cout << "-dump <tiles_file> - also save tiles with "
+            << "group and claster numbers" << std::endl;
+        std::cout << "-cache <cache_file> - load tiles from cache "
+            << "instead of splitting if input files did not change, "
+            << "otherwise split and save tiles to cache" << std::endl;
+        std::cout << "<in1>..<inN> - input files" << std::endl;
+        std::cout << "<layer_name> - name of layer, from which "
+            << "geometries are fetched. It should contain only "
+            << "polygons." << std::endl;
+        std::cout << "<driver> - name of driver, which you "
+            << "prefer to save data with." << std::endl;
+        std::cout << "<outfile> - output file name" << std::endl;
+        exit(1);
+    }
+
+    size_t nargs = args.size();
+    //имя слоя, из которого импортируем геометрию
+    std::string sourceLayerName(args[nargs - 3]);
+    //название драйвера для файла - результата
+    std::string outputDriverName(args[nargs - 2]);
+    //путь к выходному файлу
+    std::string outputFileName(args[nargs - 1]);
+    //регистрируем все драйверы
+    GDALAllRegister();
+    //список входных файлов
+    GDALUtilities::StringList flist(args.begin(), args.end() - 3);
+
+    //драйвер проверяем до начала расчетов
+    auto outDriver = static_cast<GDALDriver*>(
+        GDALGetDriverByName(outputDriverName.c_str()));
+    if (!outDriver)
+    {
+        std::cout << "Error when initializing driver \""
+            << outputDriverName << "\" "
+            << std::endl;
+        return 1;
+    }
+
+    //ключ кэша - содержимое входных файлов вместе со всеми файлами,
+    //которые GDAL читает при их открытии, слой и параметры деления.
+    //Шаг сетки рассчитывается по входным данным, поэтому
+    //при загрузке отдельно не проверяется
+    std::shared_ptr<Tiles::TileCollection> tiles;
+    //шаг сетки - из кэша или рассчитанный по полигонам
+    double grid_sz = 0;
+    Tiles::TileCacheKey cacheKey;
+    if (!cacheFileName.empty())
+    {
+        bool keyValid = true;
+        for (auto i = flist.begin();i != flist.end();i++)
+            keyValid = cacheKey.addDataset(*i, cacheFileName)
+                && keyValid;
+        cacheKey.addString(sourceLayerName);
+        cacheKey.addInt(vertexBudget);
+        if (keyValid)
+            tiles.reset(Tiles::LoadTileCache(cacheFileName,
+                cacheKey.value(), 0, &grid_sz));
+        else
+        {
+            std::cout << "Could not read input files, "
+                << "tile cache is disabled" << std::endl;
+            cacheFileName.clear();
+        }
+    }
+
+    if (tiles)
+        std::cout << "Loaded " << tiles->size() << " tiles from cache \""
+            << cacheFileName << "\"" << std::endl;
+    else
+    {
+        //1. читаем исходные полигоны
+        TempOGC collection(newGeometryCollection(), destroy);
+        GDALUtilities::LoadPolygonsFromFiles(flist, sourceLayerName,
+            [&collection](OGRPolygon *p, OGRFeature*)
+        {
+            collection->addGeometryDirectly(p);
+        }, nthreads);
+
+        //2. делим полигоны регулярной сеткой на тайлы
+        grid_sz = BridgesRPC::CalculateGridSize(collection.get());
+        if (fabs(grid_sz) < 1E-6)
+        {
+            std::cout << "Error when calculating grid size"
+                << std::endl;
+            return 1;
+        }
+        GDALUtilities::RegularGrid grid(collection.get(), grid_sz);
+        tiles.reset(BridgesRPC::SplitGeometryByGrid(collection.get(),
+            grid, false, nthreads, vertexBudget));
+        //исходные полигоны больше не нужны
+        collection.reset();
+        if (!tiles || tiles->size() == 0)
+        {
+            std::cout << "No tiles were generated" << std::endl;
+            return 1;
+        }
+        if (!cacheFileName.empty())
+            Tiles::SaveTileCache(cacheFileName, tiles.get(),
+                cacheKey.value(), grid_sz);
+    }
+    //опорные точки и радиусы нужны всем следующим этапам
+    tiles->computeMetrics(nthreads);
+
+    //3. кластеризуем тайлы по опорным точкам
+    std::shared_ptr< std::vector<int> >
+        clasters(ClasterUtils::ClasterizeTiles(tiles.get(), nclasters));
+    assert(clasters);
+
+    if (!dumpFileName.empty() &&
+        !DumpTiles(tiles.get(), *clasters, outDriver, dumpFileName))
+        return 1;
+
+    //4. граф только внутри кластеров и его остовный лес.
+    //Опорные точки тайлов соседних по диагонали ячеек удалены
+    //не больше чем на 2*sqrt(2) шага сетки, поэтому по умолчанию
+    //соединяем тайлы на расстоянии до трех шагов
+    if (maxDistance == 0)
+        maxDistance = 3 * grid_sz;
+    std::cout << "max distance = " << maxDistance << std::endl;
+    std::shared_ptr<BridgesRPC::BridgeGraph> graph(
+        BridgesRPC::CreateGraph(tiles.get(), maxDistance, false, nthreads,
+            clasters.get()));
+    std::shared_ptr<BridgesRPC::MinimumSpanningTree> tree
+        (BridgesRPC::KruskalMST(graph.get()));
+
+    //5. по мостику на каждую пару групп
+    std::shared_ptr<BridgesRPC::GroupConnectivityStruct> conn
+        (BridgesRPC::GenerateConnectivity(tree.get(), tiles.get(), nthreads));
+
+    //записываем мостики
+    GDALDataset *outDataset = outDriver->Create(outputFileName.c_str(),
+        0, 0, 0, GDT_Unknown, NULL);
+    if (!outDataset)
+    {
+        std::cout << "Could not create dataset for output file"
+            << std::endl;
+        return 1;
+    }
+    OGRLayer *outLayer = outDataset->CreateLayer("bridges", NULL,
+        wkbPolygon, NULL);
+    if (!outLayer)
+    {
+        std::cout << "Could not create layer in output file"
+            << std::endl;
+        GDALClose(outDataset);
+        return 1;
+    }
+    {
+        GDALUtilities::FeatureWriter writer(outLayer);
+        for (auto i = conn->begin();i != conn->end();i++)
+        {
+            OGC *currentCollection = (*i).second.get();
+            for (int j = 0;j < currentCollection->getNumGeometries();j++)
+                if (!writer.write(currentCollection->getGeometryRef(j)))
+                {
+                    std::cout << "Failed to create feature"
+                        << std::endl;
+                    GDALClose(outDataset);
+                    return 1;
+                }
+        }
+        if (!writer.commit())
+        {
+            std::cout << "Failed to commit features"
+                << std::endl;
+            GDALClose(outDataset);
+            return 1;
+        }
+    }
+    GDALClose(outDataset);
+
+    std::cout << "Pipeline succesful: " << tiles->size() << " tiles, "
+        << conn->size() << " bridges" << std::endl;
+    return 0;
+}
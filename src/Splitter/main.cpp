@@ -36,13 +36,34 @@ using namespace GDALUtilities::Boilerplates;
 
 int main(int argc, char *argv[])
 {
+    //аргументы командной строки
+    GDALUtilities::StringList args(argv + 1, argv + argc);
+
+    //число потоков, 0 - по числу ядер
+    int nthreads = 0;
+    std::string threadsOption;
+    if (GDALUtilities::TakeOption(args, "-threads", threadsOption))
+        nthreads = atoi(threadsOption.c_str());
+    //максимальное число вершин в куске полигона,
+    //0 - без деления полигонов на квадранты
+    int vertexBudget = 0;
+    std::string budgetOption;
+    if (GDALUtilities::TakeOption(args, "-budget", budgetOption))
+        vertexBudget = atoi(budgetOption.c_str());
+
 	//проверяем аргументы командной строки
-	if (argc < 3)
+	if (args.size() < 4)
     {
         std::cout << "USAGE: Splitter"
+            << "[-threads <n>] [-budget <n>] "
             << "<in1> <in2> .. <inN> "
             << "<layer_name> <driver> <outfile>"
             << std::endl;
+        std::cout << "-threads <n> - number of threads, "
+            << "all cores by default" << std::endl;
+        std::cout << "-budget <n> - split polygons with more "
+            << "than n vertices into quadrants before "
+            << "clipping by grid" << std::endl;
         std::cout << "<in1>..<inN> - input files" << std::endl;
         std::cout << "<layer_name> - name of layer, from which"
             << "geometries are fetched. It should contain only"
@@ -53,81 +74,29 @@ int main(int argc, char *argv[])
 		exit(1);
 	}
 
+    size_t nargs = args.size();
     //имя слоя, из которого импортируем геометрию
-    std::string sourceLayerName{argv[argc-3]};
+    std::string sourceLayerName{args[nargs-3]};
     //название драйвера для файла - результата
-    std::string outputDriverName{argv[argc-2]};
+    std::string outputDriverName{args[nargs-2]};
     //путь к выходному файлу
-    std::string outputFileName{argv[argc-1]};
+    std::string outputFileName{args[nargs-1]};
 	//регистрируем все драйверы
 	GDALAllRegister();
 	//датасеты для каждой из карт s-57
-	GDALUtilities::StringList flist;
-    for (int i = 1;i < argc - 3;i++)
-		flist.push_back(string(argv[i]));
+	GDALUtilities::StringList flist(args.begin(), args.end() - 3);
 
-	//набор датасетов
-    vector<GDALDataset*> datasets;
     //набор геометрических коллекций из входных файлов
     TempOGC collection(newGeometryCollection(),destroy);
 
-    //подгружаем файлы
-    GDALUtilities::LoadDatasets(flist, datasets);
-    //из каждого файла читаем нужный слой
-    for (vector <GDALDataset*>::iterator i =
-        datasets.begin(); i != datasets.end(); i++)
+    //читаем нужный слой из всех файлов параллельно,
+    //полигоны забираем в нашу коллекцию без копирования
+    //в порядке файлов
+    GDALUtilities::LoadPolygonsFromFiles(flist, sourceLayerName,
+        [&collection](OGRPolygon *p, OGRFeature*)
     {
-        //обходим dataset'ы, ищем нужный слой
-        //Dataset из входного файла S-57
-        GDALDataset *inputDataset = *i;
-        printf("processing file %s\n", inputDataset->GetFileList()[0]);
-        //нужный слой из Dataset входного файла S-57
-        OGRLayer *currentLayer =
-            inputDataset->GetLayerByName(sourceLayerName.c_str());
-        //нет нужного слоя
-        if (!currentLayer)
-        {
-            //выводим сообщение пользователю, что нет слоя sourceLayerName в файле
-            //затем пропускаем dataset
-            char* fname = inputDataset->GetFileList()[0];
-            if (fname)
-                printf("file %s does not contain layer %s",
-                    fname, sourceLayerName.c_str());
-            else
-                printf("layer error\n");
-            continue;
-        }
-        //сбрасываем изменения слоя, начинаем читать feature
-        currentLayer->ResetReading();
-        OGRFeature *currentFeature;
-        //красивый прогресс
-        GDALUtilities::ProgressIndicator 
-            indicator(currentLayer->GetFeatureCount(),
-                "Reading file");
-        while ((currentFeature = currentLayer->GetNextFeature()) != nullptr)
-        {
-            //отображаем прогресс в консоли
-            indicator.incOperationCount();
-            //геометрия из входного файла
-            OGRGeometry *currentGeometry;
-            currentGeometry = currentFeature->GetGeometryRef();
-            //если нет геометрии в currentFeature, пропускаем его
-            if (!currentGeometry)
-            {
-                OGRFeature::DestroyFeature(currentFeature);
-                continue;
-            }
-            //если геометрия не того типа, пропускаем feature
-            if (currentGeometry->getGeometryType() != wkbPolygon)
-            {
-                OGRFeature::DestroyFeature(currentFeature);
-                continue;
-            }
-            //добавляем копию полигон в нашу коллекцию
-            collection->addGeometry(currentGeometry);
-            OGRFeature::DestroyFeature(currentFeature);
-        }
-    }
+        collection->addGeometryDirectly(p);
+    }, nthreads);
 
     //теперь генерируем сетку для исходного набора полигонов
 
@@ -141,16 +110,9 @@ int main(int argc, char *argv[])
         return 1;
     }
 
-    //генерируем геометрию сетки
-    TempOGC grid(GDALUtilities::GenerateGrid(collection.get(), grid_sz),
-        destroy);
-    //проверяем, что она действительно создалась
-    if (!grid.get())
-    {
-        std::cout << "Error when generating grid geometries"
-            << std::endl;
-        return 1;
-    }
+    //сетка для исходного набора полигонов, ячейки
+    //создаются по мере деления
+    GDALUtilities::RegularGrid grid(collection.get(), grid_sz);
 
     //делим исходную геометрию сеткой
     //данный алгоритм опирается на свойства файлов shp - 
@@ -162,7 +124,7 @@ int main(int argc, char *argv[])
     if (!shpDriver)
     {
         std::cout << "Error when initializing driver \""
-            << argv[argc-2] << "\" "
+            << outputDriverName << "\" "
             << std::endl;
         return 1;
     }
@@ -201,25 +163,31 @@ int main(int argc, char *argv[])
     }
     //запускаем алгоритм разделения по тайлам
     std::shared_ptr<Tiles::TileCollection>
-        tiles(BridgesRPC::SplitGeometryByGrid(collection.get(), grid.get()));
-    //записываем результат в файл
-    for (auto i = tiles->begin();i != tiles->end();i++)
+        tiles(BridgesRPC::SplitGeometryByGrid(collection.get(), grid,
+            false, nthreads, vertexBudget));
+    //записываем результат в файл пакетами транзакций,
+    //геометрия тайлов не копируется
     {
-        OGRFeature *poFeature;
-        poFeature = OGRFeature::CreateFeature(outLayer->GetLayerDefn());
-        //записываем группу и индекс
-        poFeature->SetField("index", (*i).second->index());
-        poFeature->SetField("group", (*i).second->group());
-        //добавляем геометрию в feature
-        poFeature->SetGeometry((*i).second->geometry());
-        //записываем feature на диск
-        if (outLayer->CreateFeature(poFeature) != OGRERR_NONE)
+        GDALUtilities::FeatureWriter writer(outLayer);
+        for (int i = 0;i < tiles->size();i++)
+        {
+            //записываем группу и индекс
+            writer.feature()->SetField("index", i);
+            writer.feature()->SetField("group", tiles->group(i));
+            //записываем feature на диск
+            if (!writer.write(tiles->geometry(i)))
+            {
+                std::cout << "Failed to create feature"
+                    << std::endl;
+                return 1;
+            }
+        }
+        if (!writer.commit())
         {
-            std::cout << "Failed to create feature"
+            std::cout << "Failed to commit features"
                 << std::endl;
             return 1;
         }
-        OGRFeature::DestroyFeature(poFeature);
     }
     //закрываем дескриптор файла
     GDALClose(outDataset);
@@ -5,6 +5,7 @@
 
 #include <rpcbridges_dev.h>
 #include <gdalutilities.h>
+#include <tilecache.h>
 
 #include <boost/graph/adjacency_list.hpp>
 
@@ -131,9 +132,9 @@ TEST(TilesCase, CountWithDoubleBug)
     //generateGrid сделает один лишний элемент, поскольку
     //округляет double до максимального ближайшего int
     //число тайлов - 2 из-за не
-    TempOGC grid(GDALUtilities::GenerateGrid(c.get(), 0.1), destroy);
+    GDALUtilities::RegularGrid grid(c.get(), 0.1);
     shared_ptr<BridgesRPC::TileCollection> tiles
-        (BridgesRPC::SplitGeometryByGrid(c.get(), grid.get()));
+        (BridgesRPC::SplitGeometryByGrid(c.get(), grid));
     EXPECT_EQ(2, tiles->size());
 }
 
@@ -156,12 +157,160 @@ TEST(TilesCase, Count)
     c->addGeometryDirectly(p);
 
     //но число тайлов все равно должно быть 6
-    TempOGC grid(GDALUtilities::GenerateGrid(c.get(), 0.1), destroy);
+    GDALUtilities::RegularGrid grid(c.get(), 0.1);
     shared_ptr<BridgesRPC::TileCollection> tiles
-        (BridgesRPC::SplitGeometryByGrid(c.get(), grid.get()));
+        (BridgesRPC::SplitGeometryByGrid(c.get(), grid));
     //в результате должны быть только полигоны из внешней кромки (8)
     //всего их 9
     EXPECT_EQ(8,tiles->size());
+
+    //то же для сетки в виде коллекции полигонов
+    TempOGC gridCollection(GDALUtilities::GenerateGrid(c.get(), 0.1), destroy);
+    shared_ptr<BridgesRPC::TileCollection> collectionTiles
+        (BridgesRPC::SplitGeometryByGrid(c.get(), gridCollection.get()));
+    ASSERT_EQ(tiles->size(), collectionTiles->size());
+    for (int i = 0;i < tiles->size();i++)
+        EXPECT_EQ(tiles->group(i), collectionTiles->group(i));
+}
+
+//деление на квадранты не меняет число и площадь тайлов
+TEST(TilesCase, VertexBudget)
+{
+    using namespace GDALUtilities::Boilerplates;
+    using std::shared_ptr;
+
+    //многоугольник с большим числом вершин
+    TempOGC c(newGeometryCollection(), destroy);
+    OLR *r = newLinearRing();
+    const int n = 400;
+    for (int i = 0;i < n;i++)
+    {
+        double phi = 2 * 3.14159265358979323846*i / n;
+        double rad = 1 + 0.1*(i % 2);
+        r->addPoint(rad*cos(phi), rad*sin(phi));
+    }
+    r->closeRings();
+    OGRPolygon *p = newPolygon();
+    p->addRingDirectly(r);
+    c->addGeometryDirectly(p);
+
+    GDALUtilities::RegularGrid grid(c.get(), 0.1);
+    shared_ptr<BridgesRPC::TileCollection> whole
+        (BridgesRPC::SplitGeometryByGrid(c.get(), grid));
+    shared_ptr<BridgesRPC::TileCollection> quadtree
+        (BridgesRPC::SplitGeometryByGrid(c.get(), grid, false, 0, 16));
+    ASSERT_EQ(whole->size(), quadtree->size());
+    double wholeArea = 0, quadtreeArea = 0;
+    for (int i = 0;i < whole->size();i++)
+    {
+        wholeArea += static_cast<OGRPolygon*>(whole->geometry(i))->get_Area();
+        quadtreeArea += static_cast<OGRPolygon*>(quadtree->geometry(i))->get_Area();
+    }
+    EXPECT_NEAR(wholeArea, quadtreeArea, 1e-9);
+}
+
+//ячейки регулярной сетки совпадают с элементами GenerateGrid
+TEST(GridCase, RegularGrid)
+{
+    using namespace GDALUtilities::Boilerplates;
+
+    TempOGC c(newGeometryCollection(), destroy);
+    OLR *r = newLinearRing();
+    r->addPoint(0, 0);
+    r->addPoint(0, 0.35);
+    r->addPoint(0.5, 0.35);
+    r->addPoint(0.5, 0);
+    r->addPoint(0, 0);
+    OGRPolygon *p = newPolygon();
+    p->addRingDirectly(r);
+    c->addGeometryDirectly(p);
+
+    TempOGC generated(GDALUtilities::GenerateGrid(c.get(), 0.1), destroy);
+    GDALUtilities::RegularGrid grid(c.get(), 0.1);
+    ASSERT_EQ(generated->getNumGeometries(), grid.size());
+    EXPECT_EQ(4, grid.rows());
+    EXPECT_EQ(5, grid.cols());
+    for (int row = 0;row < grid.rows();row++)
+        for (int col = 0;col < grid.cols();col++)
+        {
+            std::shared_ptr<OGRPolygon> cell(grid.cell(row, col), destroy);
+            EXPECT_TRUE(cell->Equals(
+                generated->getGeometryRef(row*grid.cols() + col)));
+        }
+
+    //ячейки, касающиеся bounding box, включая соседние по границе
+    OGREnvelope env;
+    env.MinX = 0.1;
+    env.MaxX = 0.15;
+    env.MinY = 0.2;
+    env.MaxY = 0.3;
+    auto range = grid.cellsTouching(env);
+    EXPECT_EQ(0, range.firstRow);
+    EXPECT_EQ(1, range.lastRow);
+    EXPECT_EQ(0, range.firstCol);
+    EXPECT_EQ(1, range.lastCol);
+}
+
+//тайлы внутри полигона совпадают с ячейками, которые полигон
+//содержит по GEOS и которые не касаются его контуров.
+//Полигон невыпуклый, с дыркой, вершины лежат на линиях сетки
+TEST(GridCase, TilesInsidePolygon)
+{
+    using namespace GDALUtilities::Boilerplates;
+
+    OLR *r = newLinearRing();
+    r->addPoint(0, 0);
+    r->addPoint(0, 6);
+    r->addPoint(2, 6);
+    r->addPoint(2, 3);
+    r->addPoint(4, 3);
+    r->addPoint(4, 6);
+    r->addPoint(6, 6);
+    r->addPoint(7, 3);
+    r->addPoint(6, 0);
+    r->addPoint(0, 0);
+    OLR *hole = newLinearRing();
+    hole->addPoint(2, 1);
+    hole->addPoint(4, 1);
+    hole->addPoint(4, 1.5);
+    hole->addPoint(2, 2);
+    hole->addPoint(2, 1);
+    std::shared_ptr<OGRPolygon> p(newPolygon(), destroy);
+    p->addRingDirectly(r);
+    p->addRingDirectly(hole);
+    std::shared_ptr<OGRGeometry> contours(p->Boundary(), destroy);
+    ASSERT_TRUE(contours.get());
+
+    for (double gridSize : { 1.0, 0.5, 0.25 })
+    {
+        OGREnvelope env;
+        p->getEnvelope(&env);
+        GDALUtilities::RegularGrid grid(env, gridSize);
+
+        std::vector< std::pair<int, int> > expected;
+        for (int row = 0;row < grid.rows();row++)
+            for (int col = 0;col < grid.cols();col++)
+            {
+                std::shared_ptr<OGRPolygon> cell(grid.cell(row, col), destroy);
+                if (p->Contains(cell.get()) && !contours->Intersects(cell.get()))
+                    expected.push_back(std::make_pair(row, col));
+            }
+
+        TempOGC tiles(GDALUtilities::GenerateTilesInsidePolygon(p.get(), gridSize), destroy);
+        std::vector< std::pair<int, int> > actual;
+        for (int i = 0;i < tiles->getNumGeometries();i++)
+        {
+            OGREnvelope cellEnv;
+            tiles->getGeometryRef(i)->getEnvelope(&cellEnv);
+            int row = static_cast<int>(floor((env.MaxY - cellEnv.MaxY) / gridSize + 0.5));
+            int col = static_cast<int>(floor((cellEnv.MinX - env.MinX) / gridSize + 0.5));
+            actual.push_back(std::make_pair(row, col));
+        }
+        std::sort(actual.begin(), actual.end());
+
+        EXPECT_FALSE(expected.empty());
+        EXPECT_EQ(expected, actual) << "gridSize " << gridSize;
+    }
 }
 
 //тесты на корректное разделение полигонов на группы
@@ -185,12 +334,12 @@ TEST(TilesCase, Groups)
     c->addGeometryDirectly(p);
 
     //структура с группами
-    TempOGC grid(GDALUtilities::GenerateGrid(c.get(), 0.1), destroy);
+    GDALUtilities::RegularGrid grid(c.get(), 0.1);
     shared_ptr<BridgesRPC::TileCollection> tiles
-        (BridgesRPC::SplitGeometryByGrid(c.get(), grid.get()));
+        (BridgesRPC::SplitGeometryByGrid(c.get(), grid));
     //один полигон - должна быть одна группа с 6 полигонами
-    for (auto i = tiles->begin();i != tiles->end();i++)
-        EXPECT_EQ(0,(*i).second->group());
+    for (int i = 0;i < tiles->size();i++)
+        EXPECT_EQ(0,tiles->group(i));
 }
 
 //n непересекающихся полигонов - n групп
@@ -222,16 +371,573 @@ TEST(TilesCase, MultipleGroups)
     }
 
     //сетка
-    TempOGC grid(GDALUtilities::GenerateGrid(c.get(), 0.1), destroy);
+    GDALUtilities::RegularGrid grid(c.get(), 0.1);
     //тайлы
     shared_ptr<BridgesRPC::TileCollection> tiles
-        (BridgesRPC::SplitGeometryByGrid(c.get(), grid.get()));
+        (BridgesRPC::SplitGeometryByGrid(c.get(), grid));
     //n полигонов - n групп
     std::vector<bool> exist(n,false);
-    for (auto i = tiles->begin();i != tiles->end();i++)
+    for (int i = 0;i < tiles->size();i++)
     {
-        exist[(*i).second->group()] = true;
+        exist[tiles->group(i)] = true;
     }
     for (auto i = exist.begin();i != exist.end();i++)
         EXPECT_TRUE((*i));
 }
+
+//индексы тайлов выдаются коллекцией подряд начиная с 0
+TEST(TilesCase, CollectionIndices)
+{
+    Tiles::TileCollection first, second;
+    for (int i = 0;i < 5;i++)
+    {
+        EXPECT_EQ(i, first.addTile(new OGRPoint(i, i), i % 2));
+        //у каждой коллекции свой счетчик
+        EXPECT_EQ(i, second.addTile(new OGRPoint(i, i), 0));
+    }
+
+    EXPECT_EQ(5, first.size());
+    for (int i = 0;i < 5;i++)
+    {
+        EXPECT_EQ(i % 2, first.group(i));
+        EXPECT_DOUBLE_EQ(i,
+            static_cast<OGRPoint*>(first.geometry(i))->getX());
+    }
+    EXPECT_TRUE(first.inSameGroup(0, 2));
+    EXPECT_FALSE(first.inSameGroup(0, 1));
+}
+
+//капсула совпадает с оценкой площади мостика
+TEST(BridgesCase, Capsule)
+{
+    using namespace GDALUtilities::Boilerplates;
+
+    Tiles::TileMetrics m1, m2;
+    m1.center = OGRRawPoint(0, 0);
+    m2.center = OGRRawPoint(3, 4);
+    m1.inscribedRadius = 0.5;
+    m2.inscribedRadius = 1.0;
+
+    std::shared_ptr<OGRPolygon>
+        bridge(BridgesRPC::BridgeWithBufferedLine(m1, m2, 8), destroy);
+    ASSERT_TRUE(bridge.get() != nullptr);
+    EXPECT_TRUE(bridge->IsValid());
+    EXPECT_EQ(2 * 9 + 1, bridge->getExteriorRing()->getNumPoints());
+    EXPECT_NEAR(BridgesRPC::EstimateBridgeArea(m1, m2, 8),
+        bridge->get_Area(), 1e-9);
+
+    //совпадающие точки - окружность
+    std::shared_ptr<OGRPolygon> circle(
+        GDALUtilities::CreateCapsule(m1.center, m1.center, 1.0, 8), destroy);
+    EXPECT_EQ(2 * 8 + 1, circle->getExteriorRing()->getNumPoints());
+    EXPECT_TRUE(circle->IsValid());
+}
+
+//ближайшая вершина и радиус вписанной окружности по контуру
+TEST(GridCase, NearestVertex)
+{
+    using namespace GDALUtilities::Boilerplates;
+
+    OLR *r = newLinearRing();
+    r->addPoint(0, 0);
+    r->addPoint(0, 4);
+    r->addPoint(3, 4);
+    r->addPoint(3, 0);
+    r->addPoint(0, 0);
+    std::shared_ptr<OGRPolygon> p(newPolygon(), destroy);
+    p->addRingDirectly(r);
+
+    auto nearest = GDALUtilities::NearestVertex(r, 2.5, 3.0);
+    EXPECT_EQ(2, std::get<0>(nearest));
+    EXPECT_DOUBLE_EQ(1.25, std::get<1>(nearest));
+
+    OGRPoint center(1.5, 2.0);
+    EXPECT_DOUBLE_EQ(2.5, GDALUtilities::InscribedCircleRadius(p.get(), &center));
+}
+
+//полюс недоступности L-образного полигона лежит в углу,
+//центроид в этом случае оказывается вне полигона
+TEST(GridCase, PoleOfInaccessibility)
+{
+    using namespace GDALUtilities::Boilerplates;
+
+    OLR *r = newLinearRing();
+    r->addPoint(0, 0);
+    r->addPoint(10, 0);
+    r->addPoint(10, 2);
+    r->addPoint(2, 2);
+    r->addPoint(2, 10);
+    r->addPoint(0, 10);
+    r->addPoint(0, 0);
+    std::shared_ptr<OGRPolygon> p(newPolygon(), destroy);
+    p->addRingDirectly(r);
+
+    auto pole = GDALUtilities::PoleOfInaccessibility(p.get(), 0.01);
+    OGRPoint center(std::get<0>(pole).x, std::get<0>(pole).y);
+    EXPECT_TRUE(p->Contains(&center));
+    EXPECT_NEAR(1.17, std::get<1>(pole), 0.02);
+
+    //нулевая точность не приводит к бесконечному делению ячеек
+    auto exact = GDALUtilities::PoleOfInaccessibility(p.get(), 0);
+    EXPECT_NEAR(1.17, std::get<1>(exact), 0.02);
+}
+
+//пересечение полигона с прямоугольником: несколько частей,
+//прямоугольник внутри дырки, дырка внутри прямоугольника
+TEST(GridCase, ClipByRectangle)
+{
+    using namespace GDALUtilities::Boilerplates;
+
+    //буква П с дыркой в левой стойке
+    OLR *r = newLinearRing();
+    r->addPoint(0, 0);
+    r->addPoint(0, 3);
+    r->addPoint(3, 3);
+    r->addPoint(3, 0);
+    r->addPoint(2, 0);
+    r->addPoint(2, 2);
+    r->addPoint(1, 2);
+    r->addPoint(1, 0);
+    r->addPoint(0, 0);
+    OLR *hole = newLinearRing();
+    hole->addPoint(0.25, 0.25);
+    hole->addPoint(0.75, 0.25);
+    hole->addPoint(0.75, 0.75);
+    hole->addPoint(0.25, 0.75);
+    hole->addPoint(0.25, 0.25);
+    std::shared_ptr<OGRPolygon> p(newPolygon(), destroy);
+    p->addRingDirectly(r);
+    p->addRingDirectly(hole);
+
+    //прямоугольник отрезает обе стойки
+    OGREnvelope rect;
+    rect.MinX = -1;
+    rect.MaxX = 4;
+    rect.MinY = 0.5;
+    rect.MaxY = 1.5;
+    std::shared_ptr<OGRGeometry> clipped(
+        GDALUtilities::ClipPolygonByRectangle(p.get(), rect), destroy);
+    ASSERT_TRUE(clipped.get());
+    ASSERT_EQ(wkbMultiPolygon, clipped->getGeometryType());
+    auto mp = static_cast<OGRMultiPolygon*>(clipped.get());
+    EXPECT_EQ(2, mp->getNumGeometries());
+    EXPECT_NEAR(2 - 0.25*0.5, mp->get_Area(), 1e-12);
+
+    //прямоугольник внутри дырки
+    rect.MinX = 0.4;
+    rect.MaxX = 0.6;
+    rect.MinY = 0.4;
+    rect.MaxY = 0.6;
+    EXPECT_EQ(nullptr, GDALUtilities::ClipPolygonByRectangle(p.get(), rect));
+
+    //дырка целиком внутри прямоугольника
+    rect.MinX = 0;
+    rect.MaxX = 1;
+    rect.MinY = 0;
+    rect.MaxY = 1;
+    clipped.reset(GDALUtilities::ClipPolygonByRectangle(p.get(), rect), destroy);
+    ASSERT_TRUE(clipped.get());
+    ASSERT_EQ(wkbPolygon, clipped->getGeometryType());
+    auto cp = static_cast<OGRPolygon*>(clipped.get());
+    EXPECT_EQ(1, cp->getNumInteriorRings());
+    EXPECT_NEAR(0.75, cp->get_Area(), 1e-12);
+}
+
+//число полигонов и их площадь в результате пересечения.
+//Линии и точки, а также полигоны площадью не больше minArea
+//не учитываются
+static std::pair<int, double> PolygonParts(OGRGeometry *g, double minArea)
+{
+    std::pair<int, double> res(0, 0.0);
+    if (!g)
+        return res;
+    OGRwkbGeometryType type = wkbFlatten(g->getGeometryType());
+    if (type == wkbPolygon)
+    {
+        double area = static_cast<OGRPolygon*>(g)->get_Area();
+        if (area > minArea)
+        {
+            res.first = 1;
+            res.second = area;
+        }
+    }
+    else if (type == wkbMultiPolygon || type == wkbGeometryCollection)
+    {
+        OGRGeometryCollection *c = static_cast<OGRGeometryCollection*>(g);
+        for (int i = 0;i < c->getNumGeometries();i++)
+        {
+            auto part = PolygonParts(c->getGeometryRef(i), minArea);
+            res.first += part.first;
+            res.second += part.second;
+        }
+    }
+    return res;
+}
+
+//ClipPolygonByRectangle дает то же, что и OGRGeometry::Intersection,
+//с точностью до вырожденных частей
+static void ExpectSameAsIntersection(OGRPolygon *p, const OGREnvelope &rect)
+{
+    using namespace GDALUtilities::Boilerplates;
+
+    double w = rect.MaxX - rect.MinX, h = rect.MaxY - rect.MinY;
+    OGRRawPoint topLeft(rect.MinX, rect.MaxY);
+    std::shared_ptr<OGRPolygon> r(GDALUtilities::CreateRectangle(topLeft, w, h), destroy);
+    std::shared_ptr<OGRGeometry> expected(p->Intersection(r.get()), destroy);
+    std::shared_ptr<OGRGeometry> clipped(
+        GDALUtilities::ClipPolygonByRectangle(p, rect), destroy);
+
+    //тот же порог, по которому отбрасываются вырожденные части
+    double minArea = 1e-12*w*h;
+    auto e = PolygonParts(expected.get(), minArea);
+    auto c = PolygonParts(clipped.get(), minArea);
+    EXPECT_EQ(e.first, c.first);
+    EXPECT_NEAR(e.second, c.second, 1e-9*w*h);
+    if (clipped)
+        EXPECT_TRUE(clipped->IsValid());
+}
+
+//пересечение с прямоугольником в особых случаях
+//совпадает с результатом GEOS
+TEST(GridCase, ClipByRectangleDegenerate)
+{
+    using namespace GDALUtilities::Boilerplates;
+
+    //прямоугольник-полигон по координатам углов
+    auto box = [](double minX, double minY, double maxX, double maxY)
+    {
+        OGRRawPoint topLeft(minX, maxY);
+        return GDALUtilities::CreateRectangle(topLeft, maxX - minX, maxY - minY);
+    };
+    //полигон с дыркой
+    auto holed = [](OGRPolygon *outer, OGRPolygon *hole)
+    {
+        outer->addRing(hole->getExteriorRing());
+        OGRGeometryFactory::destroyGeometry(hole);
+        return outer;
+    };
+    //треугольник
+    auto triangle = [](double x0, double y0, double x1, double y1,
+        double x2, double y2)
+    {
+        OLR *r = newLinearRing();
+        r->addPoint(x0, y0);
+        r->addPoint(x1, y1);
+        r->addPoint(x2, y2);
+        r->addPoint(x0, y0);
+        OGRPolygon *p = newPolygon();
+        p->addRingDirectly(r);
+        return p;
+    };
+
+    OGREnvelope rect;
+    rect.MinX = 0;
+    rect.MaxX = 2;
+    rect.MinY = 0;
+    rect.MaxY = 2;
+
+    std::vector< std::pair<const char*, OGRPolygon*> > cases = {
+        //ребро контура на стороне прямоугольника
+        { "collinear edge", box(1, 0, 3, 1) },
+        { "same rectangle", box(0, 0, 2, 2) },
+        //вершины контура точно в углах прямоугольника
+        { "diagonal through corners", triangle(0, 0, 3, 0, 3, 3) },
+        { "touches corner", box(2, 2, 4, 4) },
+        //контур касается прямоугольника снаружи
+        { "touches side", box(2, 0.5, 3, 1.5) },
+        { "touches side from above", triangle(0.5, 3, 1.5, 3, 1, 2) },
+        //дырка касается границы прямоугольника
+        { "hole touches side inside",
+            holed(box(-1, -1, 3, 3), box(1, 0.5, 2, 1.5)) },
+        { "hole touches side outside",
+            holed(box(-1, -1, 3, 3), box(2, 0.5, 3, 1.5)) },
+        { "hole touches corner",
+            holed(box(-1, -1, 3, 3), box(2, 2, 3, 3)) },
+        //тонкие полигоны
+        { "sliver inside", box(0.5, 1, 1.5, 1 + 1e-6) },
+        { "sliver across side", box(1.5, 1, 2.5, 1 + 1e-6) },
+        { "sliver across rectangle", triangle(-1, 1, 3, 1, 3, 1 + 1e-7) },
+        { "degenerate sliver", box(0.5, 1, 1.5, 1 + 1e-14) }
+    };
+
+    for (auto c = cases.begin();c != cases.end();c++)
+    {
+        SCOPED_TRACE((*c).first);
+        std::shared_ptr<OGRPolygon> p((*c).second, destroy);
+        ExpectSameAsIntersection(p.get(), rect);
+    }
+}
+
+//тесты пространственного индекса центроидов
+
+//соседи ищутся только в соседних ячейках сетки
+TEST(GraphCase, CentroidGridNeighbours)
+{
+    BridgesRPC::CentroidGrid index(1.0);
+    index.insert(0, 0.5, 0.5);
+    index.insert(1, 1.4, 0.5);
+    index.insert(2, 2.6, 0.5);
+    index.insert(3, -0.5, -0.5);
+
+    std::vector<int> candidates;
+    index.neighbours(0.5, 0.5, candidates);
+    std::sort(candidates.begin(), candidates.end());
+
+    //точка 2 находится через ячейку, ее среди кандидатов нет
+    std::vector<int> expected = { 0, 1, 3 };
+    EXPECT_EQ(expected, candidates);
+}
+
+//с разбиением на части ребра строятся только внутри частей
+TEST(GraphCase, Partition)
+{
+    using namespace GDALUtilities::Boilerplates;
+
+    //четыре квадрата в ряд, каждый в своей группе
+    Tiles::TileCollection tiles;
+    for (int i = 0;i < 4;i++)
+    {
+        OGRRawPoint topLeft(i*0.2, 0.1);
+        tiles.addTile(GDALUtilities::CreateRectangle(topLeft, 0.1, 0.1), i);
+    }
+
+    std::vector<int> partition = { 0, 0, 1, 1 };
+    std::shared_ptr<BridgesRPC::BridgeGraph> graph(
+        BridgesRPC::CreateGraph(&tiles, 1.0, false, 1, &partition));
+    EXPECT_EQ(2, num_edges(*graph));
+    EXPECT_TRUE(edge(0, 1, *graph).second);
+    EXPECT_TRUE(edge(2, 3, *graph).second);
+    EXPECT_FALSE(edge(1, 2, *graph).second);
+}
+
+//удаляет временный файл теста и при досрочном выходе из теста
+struct TempFileGuard
+{
+    std::string name;
+    explicit TempFileGuard(const std::string &_name) : name(_name) {}
+    ~TempFileGuard()
+    {
+        std::remove(name.c_str());
+        std::remove((name + ".tmp").c_str());
+    }
+};
+
+//тайлы из кэша совпадают с сохраненными
+TEST(TilesCase, Cache)
+{
+    using namespace GDALUtilities::Boilerplates;
+
+    Tiles::TileCollection tiles;
+    //квадраты в разных группах
+    for (int i = 0;i < 3;i++)
+    {
+        OGRRawPoint topLeft(i*0.2, 0.1);
+        tiles.addTile(GDALUtilities::CreateRectangle(topLeft, 0.1, 0.1), i % 2);
+    }
+    //полигон с дыркой
+    OGRRawPoint outerTopLeft(0, 1);
+    OGRRawPoint innerTopLeft(0.25, 0.75);
+    OGRPolygon *holed = GDALUtilities::CreateRectangle(outerTopLeft, 1, 1);
+    OGRPolygon *hole = GDALUtilities::CreateRectangle(innerTopLeft, 0.5, 0.5);
+    holed->addRing(hole->getExteriorRing());
+    OGRGeometryFactory::destroyGeometry(hole);
+    tiles.addTile(holed, 5);
+    //мультиполигон из двух квадратов
+    OGRMultiPolygon *mp = new OGRMultiPolygon;
+    for (int i = 0;i < 2;i++)
+    {
+        OGRRawPoint topLeft(2 + i, 1);
+        mp->addGeometryDirectly(GDALUtilities::CreateRectangle(topLeft, 0.5, 0.5));
+    }
+    tiles.addTile(mp, 7);
+
+    Tiles::TileCacheKey key;
+    key.addString("tiles");
+    key.addDouble(0.1);
+    const std::string fileName(::testing::TempDir() + "tilecache_test.bin");
+    TempFileGuard guard(fileName);
+    ASSERT_TRUE(Tiles::SaveTileCache(fileName, &tiles, key.value(), 0.1));
+
+    std::shared_ptr<Tiles::TileCollection>
+        loaded(Tiles::LoadTileCache(fileName, key.value(), 0.1));
+    ASSERT_TRUE(loaded.get() != nullptr);
+    ASSERT_EQ(tiles.size(), loaded->size());
+    for (int i = 0;i < tiles.size();i++)
+    {
+        EXPECT_EQ(tiles.group(i), loaded->group(i));
+        EXPECT_TRUE(tiles.geometry(i)->Equals(loaded->geometry(i)));
+    }
+
+    //другой ключ или другой шаг сетки - кэш устарел
+    EXPECT_TRUE(Tiles::LoadTileCache(fileName, key.value() + 1, 0.1) == nullptr);
+    EXPECT_TRUE(Tiles::LoadTileCache(fileName, key.value(), 0.2) == nullptr);
+}
+
+//при неположительном max_distance граф строится без ребер
+TEST(GraphCase, NonPositiveDistance)
+{
+    Tiles::TileCollection tiles;
+    for (int i = 0;i < 3;i++)
+    {
+        OGRRawPoint topLeft(i*0.2, 0.1);
+        tiles.addTile(GDALUtilities::CreateRectangle(topLeft, 0.1, 0.1), i);
+    }
+
+    std::shared_ptr<BridgesRPC::BridgeGraph> graph(
+        BridgesRPC::CreateGraph(&tiles, 0.0));
+    ASSERT_TRUE(graph.get() != nullptr);
+    EXPECT_EQ(3, num_vertices(*graph));
+    EXPECT_EQ(0, num_edges(*graph));
+}
+
+//квадраты со сторонами 0.1 с центрами в узлах решетки 5x5,
+//сдвинутых так, чтобы не было равных расстояний и точек на одной
+//прямой. Группа квадрата - его номер по модулю ngroups
+static void JitteredSquares(Tiles::TileCollection &tiles, int ngroups)
+{
+    for (int i = 0;i < 25;i++)
+    {
+        double x = i % 5 + 0.3*sin(7.0*i);
+        double y = i / 5 + 0.3*cos(11.0*i);
+        OGRRawPoint topLeft(x - 0.05, y + 0.05);
+        tiles.addTile(GDALUtilities::CreateRectangle(topLeft, 0.1, 0.1), i % ngroups);
+    }
+}
+
+//ребра минимального остовного дерева (меньший индекс первым)
+//и его суммарный вес
+static std::pair< std::vector< std::pair<int, int> >, double >
+    TreeEdges(BridgesRPC::BridgeGraph *graph)
+{
+    std::shared_ptr<BridgesRPC::MinimumSpanningTree>
+        tree(BridgesRPC::KruskalMST(graph));
+    std::pair< std::vector< std::pair<int, int> >, double > res;
+    res.second = 0;
+    for (auto e = tree->begin();e != tree->end();e++)
+    {
+        int s = static_cast<int>(source(*e, *graph));
+        int t = static_cast<int>(target(*e, *graph));
+        res.first.push_back(std::make_pair(std::min(s, t), std::max(s, t)));
+        res.second += get(boost::edge_weight, *graph, *e);
+    }
+    std::sort(res.first.begin(), res.first.end());
+    return res;
+}
+
+//дерево по триангуляции Делоне совпадает с деревом по графу
+//со всеми ребрами, если все тайлы в разных группах
+TEST(GraphCase, DelaunayTree)
+{
+    Tiles::TileCollection tiles;
+    JitteredSquares(tiles, 25);
+
+    std::shared_ptr<BridgesRPC::BridgeGraph> full(
+        BridgesRPC::CreateGraph(&tiles, 100.0));
+    std::shared_ptr<BridgesRPC::BridgeGraph> delaunay(
+        BridgesRPC::CreateDelaunayGraph(&tiles));
+    ASSERT_TRUE(delaunay.get() != nullptr);
+    //в триангуляции не больше 3n ребер
+    EXPECT_LE(num_edges(*delaunay), 3 * num_vertices(*delaunay));
+
+    auto expected = TreeEdges(full.get());
+    auto actual = TreeEdges(delaunay.get());
+    EXPECT_EQ(24, actual.first.size());
+    EXPECT_EQ(expected.first, actual.first);
+    EXPECT_NEAR(expected.second, actual.second, 1e-12);
+}
+
+//в графе по триангуляции нет ребер между тайлами одной группы
+TEST(GraphCase, DelaunayGroups)
+{
+    Tiles::TileCollection tiles;
+    JitteredSquares(tiles, 4);
+
+    std::shared_ptr<BridgesRPC::BridgeGraph> delaunay(
+        BridgesRPC::CreateDelaunayGraph(&tiles));
+    ASSERT_TRUE(delaunay.get() != nullptr);
+    EXPECT_LT(0, num_edges(*delaunay));
+    BridgesRPC::BridgeGraph::edge_iterator e, end;
+    for (std::tie(e, end) = edges(*delaunay);e != end;e++)
+        EXPECT_FALSE(tiles.inSameGroup(static_cast<int>(source(*e, *delaunay)),
+            static_cast<int>(target(*e, *delaunay))));
+}
+
+//тайлы с совпадающими опорными точками соединены ребром нулевого
+//веса и не мешают триангуляции
+TEST(GraphCase, DelaunayDuplicates)
+{
+    Tiles::TileCollection tiles;
+    JitteredSquares(tiles, 25);
+    //копии тайла 0: в новой группе и в группе тайла 0
+    int other = tiles.addTile(tiles.geometry(0)->clone(), 100);
+    int same = tiles.addTile(tiles.geometry(0)->clone(), tiles.group(0));
+
+    std::shared_ptr<BridgesRPC::BridgeGraph> delaunay(
+        BridgesRPC::CreateDelaunayGraph(&tiles));
+    ASSERT_TRUE(delaunay.get() != nullptr);
+    EXPECT_EQ(tiles.size(), num_vertices(*delaunay));
+
+    auto dup = edge(0, other, *delaunay);
+    ASSERT_TRUE(dup.second);
+    EXPECT_EQ(0.0, get(boost::edge_weight, *delaunay, dup.first));
+    EXPECT_FALSE(edge(0, same, *delaunay).second);
+
+    //дерево связывает все тайлы и совпадает по весу
+    //с деревом по полному графу
+    std::shared_ptr<BridgesRPC::BridgeGraph> full(
+        BridgesRPC::CreateGraph(&tiles, 100.0));
+    auto expected = TreeEdges(full.get());
+    auto actual = TreeEdges(delaunay.get());
+    EXPECT_EQ(tiles.size() - 1, actual.first.size());
+    EXPECT_NEAR(expected.second, actual.second, 1e-12);
+}
+
+//для каждой пары групп строится один мостик - с наименьшей
+//оценкой площади, пары (0,1) и (0,2) не смешиваются
+TEST(BridgesCase, ConnectivityBestBridge)
+{
+    Tiles::TileCollection tiles;
+    //квадраты со стороной 0.1: координаты левого верхнего угла и группа
+    const double squares[5][3] = {
+        { 0, 0, 0 }, { 1, 0, 1 }, { 0, 2, 0 }, { 0.5, 2, 1 }, { 0, -1, 2 } };
+    for (int i = 0;i < 5;i++)
+    {
+        OGRRawPoint topLeft(squares[i][0], squares[i][1]);
+        tiles.addTile(GDALUtilities::CreateRectangle(topLeft, 0.1, 0.1),
+            static_cast<int>(squares[i][2]));
+    }
+
+    //дерево: два ребра между группами 0 и 1 (второе короче и
+    //задано в обратном порядке) и одно между группами 0 и 2
+    BridgesRPC::BridgeGraph g(tiles.size());
+    BridgesRPC::MinimumSpanningTree tree;
+    tree.push_back(add_edge(0, 1, 1.0, g).first);
+    tree.push_back(add_edge(3, 2, 0.5, g).first);
+    tree.push_back(add_edge(0, 4, 1.0, g).first);
+
+    std::shared_ptr<BridgesRPC::GroupConnectivityStruct>
+        conn(BridgesRPC::GenerateConnectivity(&tree, &tiles));
+    ASSERT_EQ(2, conn->size());
+
+    auto pair01 = conn->find(BridgesRPC::SortedPair(1, 0));
+    auto pair02 = conn->find(BridgesRPC::SortedPair(0, 2));
+    ASSERT_TRUE(pair01 != conn->end());
+    ASSERT_TRUE(pair02 != conn->end());
+    ASSERT_EQ(1, (*pair01).second->getNumGeometries());
+    ASSERT_EQ(1, (*pair02).second->getNumGeometries());
+
+    //для пары (0,1) выбран мостик по короткому ребру
+    double longer = BridgesRPC::EstimateBridgeArea(tiles.metrics(0), tiles.metrics(1));
+    double shorter = BridgesRPC::EstimateBridgeArea(tiles.metrics(2), tiles.metrics(3));
+    ASSERT_LT(shorter, longer);
+    auto bridge01 = static_cast<OGRPolygon*>((*pair01).second->getGeometryRef(0));
+    EXPECT_NEAR(shorter, bridge01->get_Area(), 1e-9);
+    OGREnvelope env;
+    bridge01->getEnvelope(&env);
+    EXPECT_LT(1, env.MinY);
+
+    //мостик пары (0,2) идет по своему ребру
+    double area02 = BridgesRPC::EstimateBridgeArea(tiles.metrics(0), tiles.metrics(4));
+    auto bridge02 = static_cast<OGRPolygon*>((*pair02).second->getGeometryRef(0));
+    EXPECT_NEAR(area02, bridge02->get_Area(), 1e-9);
+}